@@ -0,0 +1,397 @@
+// Copyright © 2023 by Tyni Boat. All Rights Reserved.
+
+
+#include "PuzzleBoardSimulation.h"
+
+
+#pragma region Board functions
+
+
+void FPuzzleBoardSimulation::Initialize(int laneCount, int laneLength, int typeCount, int32 seed)
+{
+	_laneCount = FMath::Max(0, laneCount);
+	_laneLength = FMath::Max(0, laneLength);
+	_typeCount = FMath::Max(0, typeCount);
+	_random.Initialize(seed);
+	_cells.Reset();
+	_cells.SetNum(_laneCount * _laneLength);
+}
+
+void FPuzzleBoardSimulation::FillWithoutMatches(int minMatchCount)
+{
+	for (int i = 0; i < _laneCount; i++)
+	{
+		for (int j = 0; j < _laneLength; j++)
+		{
+			FPuzzleBoardCell& cell = _cells[i * _laneLength + j];
+			if (!cell.IsEmpty())
+				continue;
+			//Try every type once from a random one, keep the last try if they all match
+			const int firstType = RollType();
+			for (int t = 0; t < _typeCount; t++)
+			{
+				cell.Type = (firstType + t) % _typeCount;
+				if (!CompletesMatch(FIntPoint(i, j), minMatchCount))
+					break;
+			}
+		}
+	}
+}
+
+bool FPuzzleBoardSimulation::CanSwap(FIntPoint cellA, FIntPoint cellB) const
+{
+	if (!IsValidCell(cellA) || !IsValidCell(cellB))
+		return false;
+	if (FMath::Abs(cellA.X - cellB.X) + FMath::Abs(cellA.Y - cellB.Y) != 1)
+		return false;
+	const EGemCapabilities required = EGemCapabilities::CanSwap | EGemCapabilities::CanMove;
+	return GetCell(cellA).Can(required) && GetCell(cellB).Can(required);
+}
+
+void FPuzzleBoardSimulation::Swap(FIntPoint cellA, FIntPoint cellB)
+{
+	::Swap(_cells[cellA.X * _laneLength + cellA.Y], _cells[cellB.X * _laneLength + cellB.Y]);
+}
+
+bool FPuzzleBoardSimulation::FindMatches(int minMatchCount, FGridMatchArena& matches)
+{
+	const int matchesCountOnStart = matches.Num();
+
+	//Boards too large for the bitboard are scanned line by line
+	if (!_bitboard.Reset(_laneCount, _laneLength))
+	{
+		for (int i = 0; i < _laneCount; i++)
+			FindLineMatches(FIntPoint(i, 0), FIntPoint(0, 1), _laneLength, minMatchCount, matches);
+		for (int j = 0; j < _laneLength; j++)
+			FindLineMatches(FIntPoint(0, j), FIntPoint(1, 0), _laneCount, minMatchCount, matches);
+		return matches.Num() > matchesCountOnStart;
+	}
+
+	for (int i = 0; i < _laneCount; i++)
+	{
+		for (int j = 0; j < _laneLength; j++)
+		{
+			const FPuzzleBoardCell& cell = _cells[i * _laneLength + j];
+			if (!cell.Can(EGemCapabilities::CanMatch))
+				continue;
+			_bitboard.SetCell(i, j, cell.Type);
+		}
+	}
+
+	//Vertical Matches
+	for (int i = 0; i < _laneCount; i++)
+	{
+		_runsBuffer.Reset();
+		_bitboard.FindLaneRuns(i, minMatchCount, _runsBuffer);
+		for (const auto run : _runsBuffer)
+		{
+			matches.BeginMatch();
+			for (int j = run.X; j <= run.Y; j++)
+				matches.AddCell(FIntPoint(i, j));
+			matches.EndMatch();
+		}
+	}
+
+	//Horizontal Matches
+	for (int j = 0; j < _laneLength; j++)
+	{
+		_runsBuffer.Reset();
+		_bitboard.FindRowRuns(j, minMatchCount, _runsBuffer);
+		for (const auto run : _runsBuffer)
+		{
+			matches.BeginMatch();
+			for (int i = run.X; i <= run.Y; i++)
+				matches.AddCell(FIntPoint(i, j));
+			matches.EndMatch();
+		}
+	}
+	return matches.Num() > matchesCountOnStart;
+}
+
+int FPuzzleBoardSimulation::ClearMatches(const FGridMatchArena& matches, FPuzzleBoardResolution* resolution)
+{
+	int deleted = 0;
+	for (int m = 0; m < matches.Num(); m++)
+	{
+		for (const auto cell : matches.GetMatch(m))
+		{
+			if (!IsValidCell(cell))
+				continue;
+			FPuzzleBoardCell& boardCell = _cells[cell.X * _laneLength + cell.Y];
+			if (!boardCell.Can(EGemCapabilities::CanDelete))
+				continue;
+			if (resolution)
+			{
+				FPuzzleBoardEvent& event = resolution->Events.AddDefaulted_GetRef();
+				event.Type = EPuzzleBoardEventType::Delete;
+				event.Step = resolution->Steps;
+				event.Cell = cell;
+				event.GemType = boardCell.Type;
+			}
+			boardCell = FPuzzleBoardCell();
+			deleted++;
+		}
+	}
+	if (resolution)
+		resolution->DeletedCount += deleted;
+	return deleted;
+}
+
+int FPuzzleBoardSimulation::ApplyGravity(FPuzzleBoardResolution* resolution)
+{
+	int moved = 0;
+	for (int i = 0; i < _laneCount; i++)
+	{
+		FPuzzleBoardCell* lane = _cells.GetData() + i * _laneLength;
+		int landing = 0;
+		for (int j = 0; j < _laneLength; j++)
+		{
+			if (lane[j].IsEmpty())
+				continue;
+			//Immovable gems hold the gems above them
+			if (!lane[j].Can(EGemCapabilities::CanMove))
+			{
+				landing = j + 1;
+				continue;
+			}
+			if (j != landing)
+			{
+				if (resolution)
+				{
+					FPuzzleBoardEvent& event = resolution->Events.AddDefaulted_GetRef();
+					event.Type = EPuzzleBoardEventType::Fall;
+					event.Step = resolution->Steps;
+					event.From = FIntPoint(i, j);
+					event.Cell = FIntPoint(i, landing);
+					event.GemType = lane[j].Type;
+				}
+				lane[landing] = lane[j];
+				lane[j] = FPuzzleBoardCell();
+				moved++;
+			}
+			landing++;
+		}
+	}
+	return moved;
+}
+
+int FPuzzleBoardSimulation::Refill(FPuzzleBoardResolution* resolution)
+{
+	int spawned = 0;
+	for (int c = 0; c < _cells.Num(); c++)
+	{
+		FPuzzleBoardCell& cell = _cells[c];
+		if (!cell.IsEmpty())
+			continue;
+		cell.Type = RollType();
+		cell.Capabilities = EGemCapabilities::AllCapabilities;
+		if (cell.IsEmpty())
+			continue;
+		spawned++;
+		if (!resolution)
+			continue;
+		FPuzzleBoardEvent& event = resolution->Events.AddDefaulted_GetRef();
+		event.Type = EPuzzleBoardEventType::Spawn;
+		event.Step = resolution->Steps;
+		event.Cell = FIntPoint(c / _laneLength, c % _laneLength);
+		event.GemType = cell.Type;
+	}
+	return spawned;
+}
+
+bool FPuzzleBoardSimulation::Step(int minMatchCount, FPuzzleBoardResolution* resolution)
+{
+	_stepMatches.Reset();
+	if (!FindMatches(minMatchCount, _stepMatches))
+		return false;
+	if (resolution)
+	{
+		for (int m = 0; m < _stepMatches.Num(); m++)
+		{
+			resolution->Matches.BeginMatch();
+			for (const auto cell : _stepMatches.GetMatch(m))
+				resolution->Matches.AddCell(cell);
+			FPuzzleBoardEvent& event = resolution->Events.AddDefaulted_GetRef();
+			event.Type = EPuzzleBoardEventType::Match;
+			event.Step = resolution->Steps;
+			event.MatchIndex = resolution->Matches.EndMatch();
+			event.Cell = _stepMatches.GetMatch(m)[0];
+			event.GemType = GetCell(event.Cell).Type;
+		}
+	}
+	ClearMatches(_stepMatches, resolution);
+	ApplyGravity(resolution);
+	Refill(resolution);
+	if (resolution)
+		resolution->Steps++;
+	return true;
+}
+
+int FPuzzleBoardSimulation::ResolveToStable(int minMatchCount, int maxSteps, FPuzzleBoardResolution* resolution)
+{
+	int steps = 0;
+	while (steps < maxSteps && Step(minMatchCount, resolution))
+		steps++;
+	return steps;
+}
+
+bool FPuzzleBoardSimulation::ResolveSwap(FIntPoint cellA, FIntPoint cellB, int minMatchCount,
+                                         FPuzzleBoardResolution& resolution, int maxSteps)
+{
+	resolution.Reset();
+	if (!CanSwap(cellA, cellB))
+		return false;
+	Swap(cellA, cellB);
+	if (ResolveToStable(minMatchCount, maxSteps, &resolution) <= 0)
+	{
+		Swap(cellA, cellB);
+		return false;
+	}
+
+	//The swap happened before every other event
+	FPuzzleBoardEvent swapEvent;
+	swapEvent.Type = EPuzzleBoardEventType::Swap;
+	swapEvent.From = cellA;
+	swapEvent.Cell = cellB;
+	swapEvent.GemType = EmptyType;
+	resolution.Events.Insert(swapEvent, 0);
+	resolution.IsSwapAccepted = true;
+	return true;
+}
+
+int FPuzzleBoardSimulation::GetSwapMatchSize(FIntPoint cellA, FIntPoint cellB, int minMatchCount) const
+{
+	if (!CanSwap(cellA, cellB))
+		return 0;
+	const FPuzzleBoardCell& a = GetCell(cellA);
+	const FPuzzleBoardCell& b = GetCell(cellB);
+	//Same types swap to the same board
+	if (a.Type == b.Type)
+		return 0;
+	return GetMatchSizeAt(cellB, a, cellA, b, minMatchCount) + GetMatchSizeAt(cellA, b, cellB, a, minMatchCount);
+}
+
+int FPuzzleBoardSimulation::FindValidMoves(int minMatchCount, TArray<FPuzzleBoardMove>& moves) const
+{
+	const int movesCountOnStart = moves.Num();
+	ForEachValidMove(minMatchCount, [&moves](const FPuzzleBoardMove& move)
+	{
+		moves.Add(move);
+		return true;
+	});
+	return moves.Num() - movesCountOnStart;
+}
+
+bool FPuzzleBoardSimulation::HasAnyValidMove(int minMatchCount) const
+{
+	bool found = false;
+	ForEachValidMove(minMatchCount, [&found](const FPuzzleBoardMove&)
+	{
+		found = true;
+		return false;
+	});
+	return found;
+}
+
+template <typename VisitorType>
+void FPuzzleBoardSimulation::ForEachValidMove(int minMatchCount, VisitorType&& visitor) const
+{
+	//Each pair is visited once, from it's lowest cell
+	const FIntPoint steps[2] = {FIntPoint(1, 0), FIntPoint(0, 1)};
+	for (int i = 0; i < _laneCount; i++)
+	{
+		for (int j = 0; j < _laneLength; j++)
+		{
+			for (const auto step : steps)
+			{
+				FPuzzleBoardMove move;
+				move.CellA = FIntPoint(i, j);
+				move.CellB = move.CellA + step;
+				move.MatchSize = GetSwapMatchSize(move.CellA, move.CellB, minMatchCount);
+				if (move.MatchSize <= 0)
+					continue;
+				if (!visitor(move))
+					return;
+			}
+		}
+	}
+}
+
+int FPuzzleBoardSimulation::GetMatchSizeAt(FIntPoint cell, const FPuzzleBoardCell& value, FIntPoint otherCell,
+                                           const FPuzzleBoardCell& otherValue, int minMatchCount) const
+{
+	if (!value.Can(EGemCapabilities::CanMatch))
+		return 0;
+	const int minCount = FMath::Max(minMatchCount, 2);
+	const FIntPoint axes[2] = {FIntPoint(0, 1), FIntPoint(1, 0)};
+	int size = 0;
+	for (const auto axis : axes)
+	{
+		int count = 1;
+		for (const int sign : {-1, 1})
+		{
+			//Chain the run pair by pair, as FindMatches does, so a wildcard doesn't bridge two types
+			const FPuzzleBoardCell* previous = &value;
+			for (FIntPoint n = cell + axis * sign; IsValidCell(n); n += axis * sign)
+			{
+				const FPuzzleBoardCell& neighbour = n == otherCell ? otherValue : GetCell(n);
+				if (!CellsMatch(*previous, neighbour))
+					break;
+				previous = &neighbour;
+				count++;
+			}
+		}
+		if (count < minCount)
+			continue;
+		//The cell itself is counted once across both axes
+		size += size > 0 ? count - 1 : count;
+	}
+	return size;
+}
+
+bool FPuzzleBoardSimulation::CellsMatch(const FPuzzleBoardCell& cellA, const FPuzzleBoardCell& cellB)
+{
+	if (!cellA.Can(EGemCapabilities::CanMatch) || !cellB.Can(EGemCapabilities::CanMatch))
+		return false;
+	return cellA.Type == cellB.Type || cellA.Type == FPuzzleMatchBitboard::WildcardType
+		|| cellB.Type == FPuzzleMatchBitboard::WildcardType;
+}
+
+void FPuzzleBoardSimulation::FindLineMatches(FIntPoint first, FIntPoint step, int length, int minMatchCount,
+                                             FGridMatchArena& matches) const
+{
+	const int minCount = FMath::Max(minMatchCount, 2);
+	int runStart = 0;
+	for (int k = 1; k <= length; k++)
+	{
+		//Extend the run while the cells match
+		if (k < length && CellsMatch(GetCell(first + step * (k - 1)), GetCell(first + step * k)))
+			continue;
+
+		//Collect the run ending on the previous cell
+		if (k - runStart >= minCount)
+		{
+			matches.BeginMatch();
+			for (int r = runStart; r < k; r++)
+				matches.AddCell(first + step * r);
+			matches.EndMatch();
+		}
+		runStart = k;
+	}
+}
+
+bool FPuzzleBoardSimulation::CompletesMatch(FIntPoint cell, int minMatchCount) const
+{
+	const int minCount = FMath::Max(minMatchCount, 2);
+	//Runs are chained pair by pair, as FindMatches does
+	int below = 0;
+	for (int j = cell.Y - 1; j >= 0 && CellsMatch(GetCell(FIntPoint(cell.X, j + 1)), GetCell(FIntPoint(cell.X, j))); j--)
+		below++;
+	int before = 0;
+	for (int i = cell.X - 1; i >= 0 && CellsMatch(GetCell(FIntPoint(i + 1, cell.Y)), GetCell(FIntPoint(i, cell.Y))); i--)
+		before++;
+	return below + 1 >= minCount || before + 1 >= minCount;
+}
+
+
+#pragma endregion
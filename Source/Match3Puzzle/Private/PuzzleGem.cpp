@@ -2,6 +2,7 @@
 
 
 #include "PuzzleGem.h"
+#include "PuzzleGridComponent.h"
 #include "UObject/Object.h"
 
 
@@ -11,7 +12,13 @@
 
 void APuzzleGem::SetGridIndex(FVector2D grid_index)
 {
-	GridIndex = grid_index;
+	SetGridIndex(FIntPoint((int32)grid_index.X, (int32)grid_index.Y));
+}
+
+void APuzzleGem::SetGridIndex(FIntPoint grid_cell)
+{
+	GridCell = grid_cell;
+	GridIndex = FVector2D(grid_cell.X, grid_cell.Y);
 }
 
 
@@ -21,9 +28,9 @@ void APuzzleGem::SetGridIndex(FVector2D grid_index)
 void APuzzleGem::OnGotSpawn_Internal()
 {
 	_gemDeletionCountDownChrono = GemDeletionDelay > 0 ? GemDeletionDelay : 0.5f;
-	SetActorHiddenInGame(false);
-	SetActorEnableCollision(true);
-	SetActorTickEnabled(true);
+	_isGemInPlay = true;
+	RefreshGemActorVisibility();
+	SetActorTickEnabled(NeedsOwnTick());
 	OnGotSpawn();
 }
 
@@ -33,6 +40,26 @@ void APuzzleGem::OnGotSpawn_Implementation()
 }
 
 
+//Gem Rendering ################################################################################
+
+
+void APuzzleGem::SetRenderedByGrid(bool renderedByGrid, int instanceIndex)
+{
+	_isRenderedByGrid = renderedByGrid;
+	_gemInstanceIndex = renderedByGrid ? instanceIndex : INDEX_NONE;
+	RefreshGemActorVisibility();
+}
+
+void APuzzleGem::RefreshGemActorVisibility()
+{
+	const bool materialized = _isGemInPlay && !ShouldRenderAsInstance();
+	SetActorHiddenInGame(!materialized);
+	SetActorEnableCollision(materialized && (!parentGrid || parentGrid->GemCollisionEnabled));
+	if (_isRenderedByGrid && parentGrid)
+		parentGrid->SyncGemInstance(this);
+}
+
+
 //Gem Deletion ################################################################################
 
 
@@ -47,8 +74,8 @@ void APuzzleGem::OnGotDeleted_Implementation()
 void APuzzleGem::OnGotDeleted_Internal()
 {
 	OnGotDeleted();
-	SetActorHiddenInGame(true);
-	SetActorEnableCollision(false);
+	_isGemInPlay = false;
+	RefreshGemActorVisibility();
 	SetActorTickEnabled(false);
 	//Detach all attachment
 	if (_attachmentList.Num() > 0)
@@ -93,6 +120,25 @@ void APuzzleGem::UpdateGemVelocity(float delta)
 	_lastGemLocation = GetActorLocation();
 }
 
+void APuzzleGem::UpdateGem(float delta)
+{
+	HandleAttachments();
+	UpdateGemVelocity(delta);
+}
+
+void APuzzleGem::SetTickedByGrid(bool tickedByGrid)
+{
+	_isTickedByGrid = tickedByGrid;
+	SetActorTickEnabled(_isGemInPlay && NeedsOwnTick());
+}
+
+bool APuzzleGem::NeedsOwnTick() const
+{
+	if (!_isTickedByGrid)
+		return true;
+	return GetClass()->IsFunctionImplementedInScript(GET_FUNCTION_NAME_CHECKED(APuzzleGem, ReceiveTick));
+}
+
 
 //Gem attachments #######################################################################
 
@@ -125,6 +171,9 @@ void APuzzleGem::AttachToGem(TScriptInterface<IPuzzleGemAttachment> attachment)
 	}
 	attachment->Execute_OnAttach(attachment.GetObject(), this, false);
 	OnAttachToGem(attachment);
+	RefreshGemCapabilities();
+	if (_isRenderedByGrid)
+		RefreshGemActorVisibility();
 }
 
 void APuzzleGem::DetachFromGem(TScriptInterface<IPuzzleGemAttachment> attachment)
@@ -135,6 +184,9 @@ void APuzzleGem::DetachFromGem(TScriptInterface<IPuzzleGemAttachment> attachment
 		_attachmentList.Remove(attachment);
 	attachment->Execute_OnDetach(attachment.GetObject(), this, false);
 	OnDetachFromGem(attachment);
+	RefreshGemCapabilities();
+	if (_isRenderedByGrid)
+		RefreshGemActorVisibility();
 }
 
 void APuzzleGem::OnAttachToGem_Implementation(const TScriptInterface<IPuzzleGemAttachment>& attachment)
@@ -149,72 +201,48 @@ void APuzzleGem::HandleAttachments()
 {
 	if (_attachmentList.Num() <= 0)
 		return;
+	bool removedAttachment = false;
 	for (int i = _attachmentList.Num() - 1; i >= 0; i--)
 	{
 		if (_attachmentList[i])
 			continue;
 		_attachmentList.RemoveAt(i);
+		removedAttachment = true;
 	}
+	if (!removedAttachment)
+		return;
+	RefreshGemCapabilities();
+	if (_isRenderedByGrid)
+		RefreshGemActorVisibility();
 }
 
-bool APuzzleGem::CanSelectGem()
-{
-	if (_attachmentList.Num() <= 0)
-		return true;
-	const int cannotSelectIndex = _attachmentList.IndexOfByPredicate([&](
-		TScriptInterface<IPuzzleGemAttachment> attachment)
-		{
-			return !attachment->Execute_CanSelectGem(attachment.GetObject(), this);
-		});
-	return cannotSelectIndex < 0;
-}
-
-bool APuzzleGem::CanSwapGem()
-{
-	if (_attachmentList.Num() <= 0)
-		return true;
-	const int cannotSwapIndex = _attachmentList.IndexOfByPredicate([&](
-		TScriptInterface<IPuzzleGemAttachment> attachment)
-		{
-			return !attachment->Execute_CanSwapGem(attachment.GetObject(), this);
-		});
-	return cannotSwapIndex < 0;
-}
-
-bool APuzzleGem::CanMoveGem()
-{
-	if (_attachmentList.Num() <= 0)
-		return true;
-	const int cannotMoveIndex = _attachmentList.IndexOfByPredicate([&](
-		TScriptInterface<IPuzzleGemAttachment> attachment)
-		{
-			return !attachment->Execute_CanMoveGem(attachment.GetObject(), this);
-		});
-	return cannotMoveIndex < 0;
-}
-
-bool APuzzleGem::CanDeleteGem()
-{
-	if (_attachmentList.Num() <= 0)
-		return true;
-	const int cannotDeleteIndex = _attachmentList.IndexOfByPredicate([&](
-		TScriptInterface<IPuzzleGemAttachment> attachment)
-		{
-			return !attachment->Execute_CanDeleteGem(attachment.GetObject(), this);
-		});
-	return cannotDeleteIndex < 0;
-}
-
-bool APuzzleGem::CanMatchGem()
+void APuzzleGem::RefreshGemCapabilities()
 {
-	if (_attachmentList.Num() <= 0)
-		return true;
-	const int cannotMatchIndex = _attachmentList.IndexOfByPredicate([&](
-		TScriptInterface<IPuzzleGemAttachment> attachment)
-		{
-			return !attachment->Execute_CanMatchGem(attachment.GetObject(), this);
-		});
-	return cannotMatchIndex < 0;
+	EGemCapabilities capabilities = EGemCapabilities::AllCapabilities;
+	for (const auto& attachment : _attachmentList)
+	{
+		if (!attachment)
+			continue;
+		UObject* object = attachment.GetObject();
+		if (!IPuzzleGemAttachment::Execute_CanSelectGem(object, this))
+			EnumRemoveFlags(capabilities, EGemCapabilities::CanSelect);
+		if (!IPuzzleGemAttachment::Execute_CanSwapGem(object, this))
+			EnumRemoveFlags(capabilities, EGemCapabilities::CanSwap);
+		if (!IPuzzleGemAttachment::Execute_CanMoveGem(object, this))
+			EnumRemoveFlags(capabilities, EGemCapabilities::CanMove);
+		if (!IPuzzleGemAttachment::Execute_CanDeleteGem(object, this))
+			EnumRemoveFlags(capabilities, EGemCapabilities::CanDelete);
+		if (!IPuzzleGemAttachment::Execute_CanMatchGem(object, this))
+			EnumRemoveFlags(capabilities, EGemCapabilities::CanMatch);
+	}
+	if (capabilities == _gemCapabilities)
+		return;
+	_gemCapabilities = capabilities;
+	if (parentGrid)
+	{
+		parentGrid->MarkCellDirty(GridCell);
+		parentGrid->WakeNodeAt(GridCell);
+	}
 }
 
 
@@ -239,6 +267,15 @@ void APuzzleGem::SetGemEquatable(TScriptInterface<IPuzzleGemEquatable> equatable
 		object->ConditionalBeginDestroy();
 	}
 	_gemEquatable = equatable;
+	_gemTypeKey = _gemEquatable.GetObject()
+		              ? IPuzzleGemEquatable::Execute_GetGemTypeKey(_gemEquatable.GetObject())
+		              : INDEX_NONE;
+	if (parentGrid)
+	{
+		parentGrid->MarkCellDirty(GridCell);
+		if (_isRenderedByGrid)
+			parentGrid->SyncGemInstance(this);
+	}
 }
 
 bool APuzzleGem::CompareGemTo(APuzzleGem* other)
@@ -249,6 +286,8 @@ bool APuzzleGem::CompareGemTo(APuzzleGem* other)
 		return true;
 	if(!_gemEquatable ^ !other->_gemEquatable)
 		return true;
+	if(_gemTypeKey != INDEX_NONE && other->_gemTypeKey != INDEX_NONE)
+		return _gemTypeKey == other->_gemTypeKey;
 	return _gemEquatable->Execute_GemEquals(_gemEquatable.GetObject(), other->_gemEquatable);
 }
 
@@ -286,8 +325,9 @@ void APuzzleGem::BeginPlay()
 void APuzzleGem::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
-	HandleAttachments();
-	UpdateGemVelocity(DeltaTime);
+	if (_isTickedByGrid)
+		return;
+	UpdateGem(DeltaTime);
 }
 
 
@@ -9,3 +9,8 @@ bool IPuzzleGemEquatable::GemEquals_Implementation(const TScriptInterface<IPuzzl
 {
 	return false;
 }
+
+int IPuzzleGemEquatable::GetGemTypeKey_Implementation()
+{
+	return INDEX_NONE;
+}
@@ -3,6 +3,9 @@
 
 #include "../Public/PuzzleGridComponent.h"
 
+#include "Async/ParallelFor.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "GameFramework/PlayerController.h"
 #include "Kismet/KismetSystemLibrary.h"
 
 
@@ -11,69 +14,251 @@
 
 void UPuzzleGridComponent::InitializeGrid(FVector2D grid_size, FVector2D node_size,
                                           TSubclassOf<UPuzzleLaneComponent> lane_class)
+{
+	BeginGridInit(grid_size, node_size, lane_class);
+	StepGridInit(-1);
+}
+
+void UPuzzleGridComponent::InitializeGridAsync(FVector2D grid_size, FVector2D node_size,
+                                               TSubclassOf<UPuzzleLaneComponent> lane_class)
+{
+	BeginGridInit(grid_size, node_size, lane_class);
+}
+
+void UPuzzleGridComponent::BeginGridInit(FVector2D grid_size, FVector2D node_size,
+                                         TSubclassOf<UPuzzleLaneComponent> lane_class)
 {
 	//Clear the grid first
 	ClearGrid();
+	ResizeGridStorage(grid_size);
+
+	//Grid basis
+	_nodeDistance = node_size.Y;
+	_laneDistance = node_size.X;
+	RefreshGridBasis();
+	_initLaneClass = lane_class;
+	_initLaneCount = 0;
+	_initGemCount = 0;
+	_isGridInitializing = true;
+
+	//Create gem instances
+	_hasWarnedUnkeyedInstance = false;
+	if (GemRenderMode == InstancedGemMeshes && InstancedGemMesh)
+	{
+		_gemInstances = NewObject<UInstancedStaticMeshComponent>(this);
+		_gemInstances->SetupAttachment(this);
+		_gemInstances->SetStaticMesh(InstancedGemMesh);
+		if (InstancedGemMaterial)
+			_gemInstances->SetMaterial(0, InstancedGemMaterial);
+		_gemInstances->NumCustomDataFloats = 1;
+		_gemInstances->SetCollisionEnabled(GemCollisionEnabled
+			                                   ? ECollisionEnabled::QueryOnly
+			                                   : ECollisionEnabled::NoCollision);
+		_gemInstances->SetCollisionResponseToAllChannels(ECR_Ignore);
+		_gemInstances->SetCollisionResponseToChannel(InputTraceChannel, ECR_Block);
+		_gemInstances->RegisterComponent();
+	}
+}
 
-	//Create Lanes
+void UPuzzleGridComponent::ResizeGridStorage(FVector2D grid_size)
+{
+	//Size the flat cell storage
+	_laneCount = FMath::Max(0, (int)grid_size.X);
+	_laneLength = FMath::Max(0, (int)grid_size.Y);
+	GridSize = FVector2D(_laneCount, _laneLength);
+	_gemsInGrid.Reset();
+	_nodesInGrid.Reset();
+	_gemsInGrid.SetNumZeroed(_laneCount * _laneLength);
+	_nodesInGrid.SetNumZeroed(_laneCount * _laneLength);
+	_dirtyLanes.Init(true, _laneCount);
+	_dirtyRows.Init(true, _laneLength);
+	_isGridDirty = true;
+	_activeNodes.Init(true, _laneCount * _laneLength);
+	_swapLockedCells.Init(false, _laneCount * _laneLength);
+	_swapSequences.Init(0, _laneCount * _laneLength);
+	_nextSwapSequence = 1;
+	_swapHistoryCount = 0;
+	_pendingDeletionSlots.Init(false, _laneCount * _laneLength);
+	_recycledSlots.Init(false, _laneCount * _laneLength);
+	_pendingRefillLanes.Init(false, _laneCount);
+	_parkedRefillLanes.Init(false, _laneCount);
+	_isRecyclerStarved = false;
+	_isSimulationStale = true;
+}
+
+bool UPuzzleGridComponent::StepGridInit(double budgetSeconds)
+{
+	if (!_isGridInitializing)
+		return true;
+	const double startTime = FPlatformTime::Seconds();
+	const int gemCount = _laneCount * _laneLength;
+	//At least one element per step, so any budget makes progress
+	do
 	{
-		_nodeDistance = node_size.Y;
-		_laneDistance = node_size.X;
-		const FVector laneOffsetUnit = GetLaneDirection();
-		const FVector nodeOffsetUnit = GetNodeDirection();
-		const FVector firstLanePosition = GetComponentLocation()
-			- (FMath::Clamp(grid_size.X - 1, 0, FMath::Abs(grid_size.X)) * 0.5f) * laneOffsetUnit
-			- (FMath::Clamp(grid_size.Y - 1, 0, FMath::Abs(grid_size.Y)) * 0.5f) * nodeOffsetUnit;
+		if (_initLaneCount < _laneCount)
+			CreateLaneAt(_initLaneCount++);
+		else if (_initGemCount < gemCount)
+			SpawnGridGem(_initGemCount++);
+		else
+			break;
+	}
+	while (budgetSeconds < 0 || FPlatformTime::Seconds() - startTime < budgetSeconds);
+
+	if (_initLaneCount < _laneCount || _initGemCount < gemCount)
+		return false;
+
+	//Emit Init event
+	_isGridInitializing = false;
+	_initLaneClass = nullptr;
+	OnGridInit();
+	return true;
+}
+
+void UPuzzleGridComponent::CreateLaneAt(int lane_index)
+{
+	UPuzzleLaneComponent* instance = NewObject<UPuzzleLaneComponent>(this, _initLaneClass);
+	instance->SetupAttachment(this);
+	instance->RegisterComponent();
+	instance->SetWorldLocation(GetLaneLocation(lane_index));
+	bool popMethodAll = false;
+	const EGridGemNodePopMethod popMethod = GetLanePopMethod(lane_index, popMethodAll);
+	instance->InitializeLane(this, _laneLength, lane_index, popMethod, popMethodAll);
+	instance->SetTickedByGrid(BatchGridTick);
+	instance->SetUsesRefillPlanner(PlanLaneRefills);
+	_lanesInGrid.Add(instance);
+
+	//Fit node array
+	for (int j = 0; j < _laneLength; j++)
+		_nodesInGrid[GetCellIndex(lane_index, j)] = instance->GetNodeAtIndex(j);
+}
+
+FVector UPuzzleGridComponent::GetLaneLocation(int lane_index) const
+{
+	const FVector firstLanePosition = GetComponentLocation()
+		- (FMath::Max(_laneCount - 1, 0) * 0.5f) * _laneDirection
+		- (FMath::Max(_laneLength - 1, 0) * 0.5f) * _nodeDirection;
+	return firstLanePosition + _laneDirection * lane_index;
+}
 
-		for (int i = 0; i < grid_size.X; i++)
+EGridGemNodePopMethod UPuzzleGridComponent::GetLanePopMethod(int lane_index, bool& forall)
+{
+	EGridGemNodePopMethod popMethod = GetNodePopMethodFromGridStrategy(FillingStrategy, forall);
+	//Set inner gem fill method
+	if (lane_index == 0)
+		popMethod = forall ? popMethod : fromLastLaneDirection;
+	if (lane_index == (_laneCount - 1))
+		popMethod = forall ? popMethod : fromNextLaneDirection;
+	return popMethod;
+}
+
+void UPuzzleGridComponent::ResizeGrid(FVector2D grid_size, FVector2D node_size)
+{
+	//Nothing to keep
+	if (_lanesInGrid.Num() <= 0 || _isGridInitializing)
+	{
+		InitializeGrid(grid_size, node_size, LaneClass);
+		return;
+	}
+
+	//Every gem goes back to the recycler bin, with no pending deletion nor swap
+	for (int i = _activeSwaps.Num() - 1; i >= 0; i--)
+		RemoveActiveSwap(i);
+	for (const auto gem : _gemToBeDestroyed)
+		DeleteGem_Internal(gem);
+	_gemToBeDestroyed.Empty();
+	for (const auto gem : _gemsAll)
+		DeleteGem_Internal(gem);
+	_lastSelectedGem = nullptr;
+
+	//Delete the lanes past the new count
+	const int laneCount = FMath::Max(0, (int)grid_size.X);
+	for (int i = _lanesInGrid.Num() - 1; i >= laneCount; i--)
+	{
+		if (_lanesInGrid[i])
 		{
-			UPuzzleLaneComponent* instance = NewObject<UPuzzleLaneComponent>(this, lane_class);
-			instance->SetupAttachment(this);
-			instance->RegisterComponent();
-			instance->SetWorldLocation(firstLanePosition + laneOffsetUnit * i);
-			bool popMethodAll = false;
-			EGridGemNodePopMethod popMethod = GetNodePopMethodFromGridStrategy(FillingStrategy, popMethodAll);
-			//Set inner gem fill method
-			if (i == 0)
-				popMethod = popMethodAll ? popMethod : fromLastLaneDirection;
-			if (i == (grid_size.X - 1))
-				popMethod = popMethodAll ? popMethod : fromNextLaneDirection;
-			instance->InitializeLane(this, grid_size.Y, i, popMethod, popMethodAll);
-			_lanesInGrid.Add(instance);
+			_lanesInGrid[i]->CLearLane();
+			_lanesInGrid[i]->DestroyComponent();
 		}
+		_lanesInGrid.RemoveAt(i);
 	}
 
-	//create Gems
+	//Resize the storage and place the kept lanes
+	ResizeGridStorage(grid_size);
+	_nodeDistance = node_size.Y;
+	_laneDistance = node_size.X;
+	RefreshGridBasis();
+	for (int i = 0; i < _lanesInGrid.Num(); i++)
 	{
-		_gemsInGrid.Empty();
-		for (int i = 0; i < grid_size.X; i++)
-		{
-			for (int j = 0; j < grid_size.Y; j++)
-			{
-				//Create Gem
-				APuzzleGem* Gem = GetWorld()->SpawnActor<APuzzleGem>(GemClass);
-				if (!Gem)
-					continue;
-				Gem->parentGrid = this;
-				Gem->SetActorLocation(GetComponentLocation());
-				Gem->AttachToActor(GetOwner(), FAttachmentTransformRules::KeepWorldTransform, GemSocket);
-				_gemsAll.AddUnique(Gem);
-				OnGemSpawned(Gem, true);
-				DeleteGem_Internal(Gem);
+		const auto lane = _lanesInGrid[i];
+		if (!lane)
+			continue;
+		lane->SetWorldLocation(GetLaneLocation(i));
+		bool popMethodAll = false;
+		const EGridGemNodePopMethod popMethod = GetLanePopMethod(i, popMethodAll);
+		lane->ResizeLane(_laneLength, i, popMethod, popMethodAll);
+		lane->SetTickedByGrid(BatchGridTick);
+		lane->SetUsesRefillPlanner(PlanLaneRefills);
+		for (int j = 0; j < _laneLength; j++)
+			_nodesInGrid[GetCellIndex(i, j)] = lane->GetNodeAtIndex(j);
+	}
 
+	//Create the missing lanes
+	_initLaneClass = LaneClass;
+	for (int i = _lanesInGrid.Num(); i < _laneCount; i++)
+		CreateLaneAt(i);
+	_initLaneClass = nullptr;
 
-				//Fit gem map
-				_gemsInGrid.Add(FVector2D(i, j), nullptr);
-			}
-		}
+	//Keep one gem per cell: delete the last gems, or spawn the missing ones
+	const int gemCount = _laneCount * _laneLength;
+	for (int i = _gemsAll.Num() - 1; i >= gemCount; i--)
+	{
+		const auto gem = _gemsAll[i];
+		_gemsAll.RemoveAt(i);
+		if (!gem)
+			continue;
+		_gemsRecyclerBin.Remove(gem);
+		//Gem instances were added in gem slot order, the last ones go without shifting the others
+		if (_gemInstances && gem->GetGemInstanceIndex() != INDEX_NONE)
+			_gemInstances->RemoveInstance(gem->GetGemInstanceIndex());
+		gem->Destroy();
 	}
+	_recycledSlots.Init(false, gemCount);
+	for (const auto gem : _gemsRecyclerBin)
+		SetGemInSlotSet(gem, _recycledSlots, true);
+	for (int i = _gemsAll.Num(); i < gemCount; i++)
+		SpawnGridGem(i);
 
-	//Emit Init event
+	MarkGridDirty();
 	OnGridInit();
 }
 
+void UPuzzleGridComponent::SpawnGridGem(int gem_index)
+{
+	//Deferred, so the gem knows it's grid before it begins play
+	const FTransform spawnTransform(GetComponentLocation());
+	APuzzleGem* Gem = GetWorld()->SpawnActorDeferred<APuzzleGem>(GemClass, spawnTransform);
+	if (!Gem)
+		return;
+	Gem->parentGrid = this;
+	Gem->FinishSpawning(spawnTransform);
+	Gem->AttachToActor(GetOwner(), FAttachmentTransformRules::KeepWorldTransform, GemSocket);
+	Gem->SetTickedByGrid(BatchGridTick);
+	Gem->SetGemSlot(_gemsAll.Add(Gem));
+	if (_gemInstances)
+	{
+		const int instance = _gemInstances->AddInstance(
+			FTransform(FQuat::Identity, Gem->GetActorLocation(), FVector::ZeroVector), true);
+		Gem->SetRenderedByGrid(true, instance);
+	}
+	OnGemSpawned(Gem, true);
+	DeleteGem_Internal(Gem);
+}
+
 void UPuzzleGridComponent::ClearGrid()
 {
+	_isGridInitializing = false;
+	_initLaneClass = nullptr;
+
 	//Delete Lanes
 	for (int i = _lanesInGrid.Num() - 1; i >= 0; i--)
 	{
@@ -95,7 +280,29 @@ void UPuzzleGridComponent::ClearGrid()
 	}
 	_gemsAll.Empty();
 	_gemsInGrid.Empty();
+	_nodesInGrid.Empty();
 	_gemsRecyclerBin.Empty();
+	_pendingDeletionSlots.Empty();
+	_recycledSlots.Empty();
+	_swapSequences.Empty();
+	_swapHistoryCount = 0;
+	_laneCount = 0;
+	_laneLength = 0;
+	_dirtyLanes.Empty();
+	_dirtyRows.Empty();
+	_isGridDirty = false;
+	_activeNodes.Empty();
+	_swapLockedCells.Empty();
+	_activeSwaps.Empty();
+	_pendingRefillLanes.Empty();
+	_parkedRefillLanes.Empty();
+	_isRecyclerStarved = false;
+	_matchArena.Reset();
+	if (_gemInstances)
+	{
+		_gemInstances->DestroyComponent();
+		_gemInstances = nullptr;
+	}
 }
 
 void UPuzzleGridComponent::OnGridInit_Implementation()
@@ -152,6 +359,143 @@ void UPuzzleGridComponent::SetTimeScale(float timeScale)
 	}
 }
 
+void UPuzzleGridComponent::UpdateGridElements(float delta)
+{
+	//Refill lanes with new vacancies
+	const float nodeDelta = delta * _gridTimeScale;
+	HandleRefillQueue(nodeDelta);
+
+	//Gem requests of awake nodes, lane by lane from the bottom so gems cascade in the same order every frame
+	_gemMotions.Reset();
+	for (int i = _activeNodes.Find(true); i != INDEX_NONE; i = _activeNodes.FindFrom(true, i + 1))
+	{
+		const auto node = _nodesInGrid[i];
+		if (!node)
+		{
+			_activeNodes[i] = false;
+			continue;
+		}
+		node->RequestGemFromLane(nodeDelta);
+		FNodeGemMotion motion;
+		if (node->BeginGemMotion(nodeDelta, motion))
+			_gemMotions.Add(motion);
+	}
+
+	//Motion math on worker threads, then commit on the game thread
+	ParallelFor(_gemMotions.Num(), [this](int index)
+	{
+		UPuzzleNodeComponent::EvaluateGemMotion(_gemMotions[index]);
+	}, _gemMotions.Num() < ParallelMotionMinCount);
+	for (const auto& motion : _gemMotions)
+		motion.Node->EndGemMotion(nodeDelta, motion, true);
+
+	//Put settled nodes to sleep
+	for (int i = _activeNodes.Find(true); i != INDEX_NONE; i = _activeNodes.FindFrom(true, i + 1))
+	{
+		const auto node = _nodesInGrid[i];
+		if (const auto gem = node->GetCurrentGem())
+			gem->UpdateGemVelocity(delta * gem->CustomTimeDilation);
+		if (node->CanNodeSleep())
+			node->SleepNode();
+	}
+
+	//Attachments of every gem in play
+	for (const auto gem : _gemsAll)
+	{
+		if (!gem || !gem->IsGemInPlay())
+			continue;
+		gem->HandleAttachments();
+	}
+}
+
+void UPuzzleGridComponent::SetNodeActive(FIntPoint grid_cell, bool active)
+{
+	const int cellIndex = GetCellIndex(grid_cell);
+	if (cellIndex == INDEX_NONE || !_activeNodes.IsValidIndex(cellIndex))
+		return;
+	_activeNodes[cellIndex] = active;
+	//The gem just settled, it's instance won't be synced while the node sleeps
+	if (!active && _gemInstances)
+		SyncGemInstance(_gemsInGrid[cellIndex]);
+}
+
+void UPuzzleGridComponent::WakeNodeAt(FIntPoint grid_cell)
+{
+	if (const auto node = GetNodeAt(grid_cell))
+		node->WakeNode();
+}
+
+void UPuzzleGridComponent::QueueLaneRefill(int lane_index)
+{
+	if (_pendingRefillLanes.IsValidIndex(lane_index))
+		_pendingRefillLanes[lane_index] = true;
+}
+
+void UPuzzleGridComponent::ParkLaneRefill(int lane_index)
+{
+	if (!_parkedRefillLanes.IsValidIndex(lane_index))
+		return;
+	_parkedRefillLanes[lane_index] = true;
+	_pendingRefillLanes[lane_index] = false;
+}
+
+void UPuzzleGridComponent::RetryParkedRefills(float delta)
+{
+	if (!_isRecyclerStarved && !_parkedRefillLanes.Contains(true))
+	{
+		_refillRetryChrono = 0;
+		return;
+	}
+	_refillRetryChrono += delta;
+	if (_refillRetryChrono < RefillRetryDelay)
+		return;
+	RequeueLaneRefills();
+}
+
+void UPuzzleGridComponent::RequeueLaneRefills()
+{
+	_refillRetryChrono = 0;
+	_isRecyclerStarved = false;
+	for (int i = _parkedRefillLanes.Find(true); i != INDEX_NONE; i = _parkedRefillLanes.FindFrom(true, i + 1))
+	{
+		_parkedRefillLanes[i] = false;
+		if (const auto lane = _lanesInGrid.IsValidIndex(i) ? _lanesInGrid[i] : nullptr)
+			lane->MarkRefillPending();
+	}
+}
+
+void UPuzzleGridComponent::HandleRefillQueue(float delta)
+{
+	//Drop first, so the batch knows every empty node
+	int vacancies = 0;
+	for (int i = _pendingRefillLanes.Find(true); i != INDEX_NONE; i = _pendingRefillLanes.FindFrom(true, i + 1))
+	{
+		if (const auto lane = _lanesInGrid.IsValidIndex(i) ? _lanesInGrid[i] : nullptr)
+			vacancies += lane->DropGems(delta);
+	}
+
+	//One batch of recycled gems shared by the queued lanes, in lane order. lanes with waiting nodes stay queued
+	_refillBatchBuffer.Reset();
+	if (vacancies > 0 && !_isRecyclerStarved)
+		_isRecyclerStarved = GetRecycledGems(vacancies, delta, _refillBatchBuffer) < vacancies;
+	int used = 0;
+	for (int i = _pendingRefillLanes.Find(true); i != INDEX_NONE; i = _pendingRefillLanes.FindFrom(true, i + 1))
+	{
+		const auto lane = _lanesInGrid.IsValidIndex(i) ? _lanesInGrid[i] : nullptr;
+		if (!lane)
+		{
+			_pendingRefillLanes[i] = false;
+			continue;
+		}
+		used += lane->FillVacancies(TArrayView<APuzzleGem* const>(_refillBatchBuffer.GetData() + used,
+		                                                          _refillBatchBuffer.Num() - used));
+		_pendingRefillLanes[i] = lane->IsRefillPending();
+		//Only the lanes with waiting nodes need the next frames, the other ones wait for the recycler
+		if (_pendingRefillLanes[i] && !lane->HasHeldNodes())
+			ParkLaneRefill(i);
+	}
+}
+
 #pragma endregion
 
 
@@ -163,22 +507,27 @@ FGemSwapHandler UPuzzleGridComponent::HandleInputs_Implementation()
 	return FGemSwapHandler();
 }
 
-void UPuzzleGridComponent::HandleSwapsOnGrid(FGemSwapHandler newSwap, TArray<FVector2D>& swapMatchPositions,
+void UPuzzleGridComponent::HandleSwapsOnGrid(const FGemSwapHandler& newSwap, TArray<FIntPoint>& swapMatchPositions,
                                              float delta)
 {
 	//Add the new swap
-	if (newSwap.IsValid())
+	if (newSwap.IsValid() && !IsCellSwapping(newSwap.GemA->GridCell) && !IsCellSwapping(newSwap.GemB->GridCell))
 	{
-		const int activeSwapIndex = _activeSwaps.IndexOfByPredicate([newSwap](FGemSwapHandler innerSwap) -> bool
+		if (!ShouldRejectSwap(newSwap))
 		{
-			return innerSwap.GemA == newSwap.GemA || innerSwap.GemB == newSwap.GemA || innerSwap.GemA == newSwap.GemB ||
-				innerSwap.GemB == newSwap.GemB;
-		});
-		if (activeSwapIndex < 0)
+			if (AdmitSwap(newSwap))
+			{
+				UpdateSwapHistory(newSwap.GemA->GridCell);
+				UpdateSwapHistory(newSwap.GemB->GridCell);
+			}
+		}
+		else if (SwapValidationMode == RejectWithAnimation)
+		{
+			AdmitSwap(newSwap, true);
+		}
+		else
 		{
-			_activeSwaps.Add(newSwap);
-			UpdateSwapHistory(newSwap.GemA->GridIndex);
-			UpdateSwapHistory(newSwap.GemB->GridIndex);
+			OnSwapEnded(false, newSwap.GemA->GridIndex, newSwap.GemB->GridIndex);
 		}
 	}
 
@@ -188,24 +537,34 @@ void UPuzzleGridComponent::HandleSwapsOnGrid(FGemSwapHandler newSwap, TArray<FVe
 	for (int i = _activeSwaps.Num() - 1; i >= 0; i--)
 	{
 		//Handle invalid swaps
-		if (!_activeSwaps[i].IsValid())
+		const auto NodeA = _activeSwaps[i].NodeA;
+		const auto NodeB = _activeSwaps[i].NodeB;
+		if (!_activeSwaps[i].IsValid() || !NodeA || !NodeB)
 		{
 			if (_activeSwaps[i].GemA)
+			{
 				_activeSwaps[i].GemA->GemState = falling;
+				WakeNodeAt(_activeSwaps[i].GemA->GridCell);
+				MarkCellDirty(_activeSwaps[i].GemA->GridCell);
+			}
 			if (_activeSwaps[i].GemB)
+			{
 				_activeSwaps[i].GemB->GemState = falling;
-			_activeSwaps.RemoveAt(i);
+				WakeNodeAt(_activeSwaps[i].GemB->GridCell);
+				MarkCellDirty(_activeSwaps[i].GemB->GridCell);
+			}
+			RemoveActiveSwap(i);
 			continue;
 		}
-		const auto NodeA = GetNodeAt(_activeSwaps[i].GemA->GridIndex);
-		const auto NodeB = GetNodeAt(_activeSwaps[i].GemB->GridIndex);
-		if (!NodeA || !NodeB)
+
+		//Rejected swaps never leave their nodes
+		if (_activeSwaps[i].isRejected)
 		{
-			if (_activeSwaps[i].GemA)
-				_activeSwaps[i].GemA->GemState = falling;
-			if (_activeSwaps[i].GemB)
-				_activeSwaps[i].GemB->GemState = falling;
-			_activeSwaps.RemoveAt(i);
+			if (HandleRejectedSwap(_activeSwaps[i], NodeA, NodeB, delta))
+			{
+				OnSwapEnded(false, _activeSwaps[i].GemA->GridIndex, _activeSwaps[i].GemB->GridIndex);
+				RemoveActiveSwap(i);
+			}
 			continue;
 		}
 
@@ -214,30 +573,37 @@ void UPuzzleGridComponent::HandleSwapsOnGrid(FGemSwapHandler newSwap, TArray<FVe
 		{
 			_activeSwaps[i].GemA->GemState = falling;
 			_activeSwaps[i].GemB->GemState = falling;
+			MarkCellDirty(_activeSwaps[i].GemA->GridCell);
+			MarkCellDirty(_activeSwaps[i].GemB->GridCell);
 			NodeA->_movementStartLocation = _activeSwaps[i].GemA->GetActorLocation();
 			NodeA->_movementAmount = 1;
 			NodeB->_movementStartLocation = _activeSwaps[i].GemB->GetActorLocation();
 			NodeB->_movementAmount = 1;
-			TArray<FVector2D> matchesPositions;
-			bool A_match = CheckMatchAroundPosition(_activeSwaps[i].GemA->GridIndex, matchesPositions);
-			bool B_match = CheckMatchAroundPosition(_activeSwaps[i].GemB->GridIndex, matchesPositions);
-
-			//No match? Swap back
-			if (!B_match && !A_match && _activeSwaps[i].isUserMadeSwap)
+			NodeA->WakeNode();
+			NodeB->WakeNode();
+			_swapMatchPositionsBuffer.Reset();
+			bool A_match = CheckMatchAroundPosition(_activeSwaps[i].GemA->GridCell, _swapMatchPositionsBuffer);
+			bool B_match = CheckMatchAroundPosition(_activeSwaps[i].GemB->GridCell, _swapMatchPositionsBuffer);
+
+			//No match? Swap back, once the cells are unlocked
+			const FGemSwapHandler swapBack(_activeSwaps[i].GemB, _activeSwaps[i].GemA);
+			const bool isSwappingBack = !B_match && !A_match && _activeSwaps[i].isUserMadeSwap;
+			if (isSwappingBack)
 			{
-				_activeSwaps.Add(FGemSwapHandler(_activeSwaps[i].GemB, _activeSwaps[i].GemA));
-				UpdateSwapHistory(_activeSwaps[i].GemB->GridIndex, true);
-				UpdateSwapHistory(_activeSwaps[i].GemA->GridIndex, true);
+				UpdateSwapHistory(_activeSwaps[i].GemB->GridCell, true);
+				UpdateSwapHistory(_activeSwaps[i].GemA->GridCell, true);
 			}
 
 			//Harvest the matching positions
-			if ((A_match || B_match) && matchesPositions.Num() > 0)
+			if ((A_match || B_match) && _swapMatchPositionsBuffer.Num() > 0)
 			{
-				for (auto pos : matchesPositions)
+				for (const auto pos : _swapMatchPositionsBuffer)
 					swapMatchPositions.AddUnique(pos);
 			}
 			OnSwapEnded(A_match || B_match, _activeSwaps[i].GemB->GridIndex, _activeSwaps[i].GemA->GridIndex);
-			_activeSwaps.RemoveAt(i);
+			RemoveActiveSwap(i);
+			if (isSwappingBack)
+				AdmitSwap(swapBack);
 			continue;
 		}
 
@@ -248,6 +614,8 @@ void UPuzzleGridComponent::HandleSwapsOnGrid(FGemSwapHandler newSwap, TArray<FVe
 			NodeB->DetachGem(true);
 			NodeA->AttachGem(_activeSwaps[i].GemB);
 			NodeB->AttachGem(_activeSwaps[i].GemA);
+			//The handles follow the gems
+			Swap(_activeSwaps[i].NodeA, _activeSwaps[i].NodeB);
 			_activeSwaps[i].GemA->GemState = swapping;
 			_activeSwaps[i].GemB->GemState = swapping;
 			_activeSwaps[i].swapCompletion += delta;
@@ -276,6 +644,78 @@ void UPuzzleGridComponent::HandleSwapsOnGrid(FGemSwapHandler newSwap, TArray<FVe
 	}
 }
 
+bool UPuzzleGridComponent::AdmitSwap(const FGemSwapHandler& newSwap, bool isRejected)
+{
+	const int cellIndexA = GetCellIndex(newSwap.GemA->GridCell);
+	const int cellIndexB = GetCellIndex(newSwap.GemB->GridCell);
+	if (cellIndexA == INDEX_NONE || cellIndexB == INDEX_NONE || _swapLockedCells[cellIndexA] || _swapLockedCells[
+		cellIndexB])
+		return false;
+	FGemSwapHandler& swap = _activeSwaps.Add_GetRef(newSwap);
+	swap.isRejected = isRejected;
+	swap.NodeA = _nodesInGrid[cellIndexA];
+	swap.NodeB = _nodesInGrid[cellIndexB];
+	_swapLockedCells[cellIndexA] = true;
+	_swapLockedCells[cellIndexB] = true;
+	//Rejected swaps never detach their gems, wake the nodes so instanced gems follow the motion
+	if (swap.NodeA)
+		swap.NodeA->WakeNode();
+	if (swap.NodeB)
+		swap.NodeB->WakeNode();
+	return true;
+}
+
+void UPuzzleGridComponent::RemoveActiveSwap(int index)
+{
+	const FGemSwapHandler& swap = _activeSwaps[index];
+	for (const auto node : {swap.NodeA, swap.NodeB})
+	{
+		const int cellIndex = node ? GetCellIndex(node->GridCell) : INDEX_NONE;
+		if (cellIndex != INDEX_NONE)
+			_swapLockedCells[cellIndex] = false;
+	}
+	_activeSwaps.RemoveAt(index);
+}
+
+bool UPuzzleGridComponent::ShouldRejectSwap(const FGemSwapHandler& newSwap)
+{
+	if (SwapValidationMode == ValidateAfterSwap || !newSwap.isUserMadeSwap)
+		return false;
+	//The board model only knows neighbour swaps, the other ones are validated after the swap
+	const FIntPoint delta = newSwap.GemA->GridCell - newSwap.GemB->GridCell;
+	if (FMath::Abs(delta.X) + FMath::Abs(delta.Y) != 1)
+		return false;
+	return GetSimulation().GetSwapMatchSize(newSwap.GemA->GridCell, newSwap.GemB->GridCell, MinMatchCount) <= 0;
+}
+
+bool UPuzzleGridComponent::HandleRejectedSwap(FGemSwapHandler& swap, UPuzzleNodeComponent* nodeA,
+                                              UPuzzleNodeComponent* nodeB, float delta)
+{
+	const FVector locationA = nodeA->GetComponentLocation();
+	const FVector locationB = nodeB->GetComponentLocation();
+	if (swap.swapCompletion >= 1)
+	{
+		swap.GemA->SetActorLocation(locationA);
+		swap.GemB->SetActorLocation(locationB);
+		swap.GemA->GemState = falling;
+		swap.GemB->GemState = falling;
+		nodeA->WakeNode();
+		nodeB->WakeNode();
+		MarkCellDirty(swap.GemA->GridCell);
+		MarkCellDirty(swap.GemB->GridCell);
+		return true;
+	}
+
+	//Go toward the other node and back
+	swap.GemA->GemState = swapping;
+	swap.GemB->GemState = swapping;
+	const float offset = FMath::Sin(swap.swapCompletion * PI) * RejectSwapAmplitude;
+	swap.GemA->SetActorLocation(FMath::Lerp(locationA, locationB, offset));
+	swap.GemB->SetActorLocation(FMath::Lerp(locationB, locationA, offset));
+	swap.swapCompletion += delta * SwapSpeed * GetTimeScale();
+	return false;
+}
+
 void UPuzzleGridComponent::AddForce(FVector force)
 {
 	if (_lanesInGrid.Num() <= 0)
@@ -290,14 +730,103 @@ void UPuzzleGridComponent::AddForce(FVector force)
 
 void UPuzzleGridComponent::AddRadialForce(FVector center, float radius, float maxIntensity)
 {
-	if (_lanesInGrid.Num() <= 0)
+	if (radius <= 0 || _nodesInGrid.Num() <= 0)
 		return;
-	for (auto lane : _lanesInGrid)
+	const float laneDistance = FMath::Abs(_laneDistance);
+	const float nodeDistance = FMath::Abs(_nodeDistance);
+	if (laneDistance <= 0 || nodeDistance <= 0)
+		return;
+
+	//Bounds of the sphere in cell space
+	const FVector local = center - GetComponentLocation();
+	const float centerLane = FVector::DotProduct(local, _laneAxis) / laneDistance + (_laneCount - 1) * 0.5f;
+	const float centerNode = FVector::DotProduct(local, _nodeAxis) / nodeDistance + (_laneLength - 1) * 0.5f;
+	const int minLane = FMath::Max(0, FMath::FloorToInt(centerLane - radius / laneDistance));
+	const int maxLane = FMath::Min(_laneCount - 1, FMath::CeilToInt(centerLane + radius / laneDistance));
+	const int minNode = FMath::Max(0, FMath::FloorToInt(centerNode - radius / nodeDistance));
+	const int maxNode = FMath::Min(_laneLength - 1, FMath::CeilToInt(centerNode + radius / nodeDistance));
+
+	//Gather the nodes in range
+	const float squaredRadius = radius * radius;
+	_radialForceCells.Reset();
+	_radialForceOffsets.Reset();
+	for (int i = minLane; i <= maxLane; i++)
 	{
-		if (!lane)
-			continue;
-		lane->AddRadialForce(center, radius, maxIntensity);
+		for (int j = minNode; j <= maxNode; j++)
+		{
+			const int cellIndex = GetCellIndex(i, j);
+			const auto node = _nodesInGrid[cellIndex];
+			if (!node)
+				continue;
+			const FVector offset = node->GetComponentLocation() - center;
+			if (offset.SquaredLength() >= squaredRadius)
+				continue;
+			_radialForceCells.Add(cellIndex);
+			_radialForceOffsets.Add(offset);
+		}
+	}
+
+	//Linear falloff from the center
+	const float inverseRadius = 1 / radius;
+	for (FVector& offset : _radialForceOffsets)
+	{
+		const float distance = offset.Length();
+		const float intensity = (1 - distance * inverseRadius) * maxIntensity;
+		offset = distance > 0 ? offset * (intensity / distance) : FVector::ZeroVector;
 	}
+	for (int k = 0; k < _radialForceCells.Num(); k++)
+		_nodesInGrid[_radialForceCells[k]]->AddImpulseForceToGem(_radialForceOffsets[k]);
+}
+
+#pragma endregion
+
+
+#pragma region Rendering functions
+
+
+void UPuzzleGridComponent::SyncGemInstance(APuzzleGem* gem)
+{
+	if (!_gemInstances || !gem)
+		return;
+	const int instanceIndex = gem->GetGemInstanceIndex();
+	if (!_gemInstances->IsValidInstance(instanceIndex))
+		return;
+	FTransform transform = gem->GetActorTransform();
+	if (!gem->ShouldRenderAsInstance())
+		transform.SetScale3D(FVector::ZeroVector);
+	_gemInstances->UpdateInstanceTransform(instanceIndex, transform, true, false, true);
+	_gemInstances->SetCustomDataValue(instanceIndex, 0, gem->GetGemTypeKey(), false);
+	_areGemInstancesDirty = true;
+	//The material can't tell apart the types of equatables without key
+	if (!_hasWarnedUnkeyedInstance && gem->GetGemEquatable() && gem->GetGemTypeKey() == INDEX_NONE)
+	{
+		_hasWarnedUnkeyedInstance = true;
+		UE_LOG(LogTemp, Warning,
+		       TEXT("%s: instanced gem %s has an equatable without type key, it renders as type -1. implement GetGemTypeKey to render it's type."),
+		       *GetName(), *gem->GetName());
+	}
+}
+
+void UPuzzleGridComponent::SyncActiveGemInstances()
+{
+	if (!_gemInstances)
+		return;
+	for (int i = _activeNodes.Find(true); i != INDEX_NONE; i = _activeNodes.FindFrom(true, i + 1))
+		SyncGemInstance(_gemsInGrid[i]);
+	if (!_areGemInstancesDirty)
+		return;
+	_gemInstances->MarkRenderStateDirty();
+	_areGemInstancesDirty = false;
+}
+
+APuzzleGem* UPuzzleGridComponent::GetGemFromInstance(int instanceIndex)
+{
+	if (!_gemInstances || !_gemsAll.IsValidIndex(instanceIndex))
+		return nullptr;
+	const auto gem = _gemsAll[instanceIndex];
+	if (!gem || gem->GetGemInstanceIndex() != instanceIndex)
+		return nullptr;
+	return gem;
 }
 
 #pragma endregion
@@ -308,15 +837,32 @@ void UPuzzleGridComponent::AddRadialForce(FVector center, float radius, float ma
 
 APuzzleGem* UPuzzleGridComponent::GetGemAt(FVector2D grid_index)
 {
-	if (_gemsInGrid.Contains(grid_index))
-		return _gemsInGrid[grid_index];
-	return nullptr;
+	const int cellIndex = GetCellIndex(grid_index);
+	if (cellIndex == INDEX_NONE)
+		return nullptr;
+	return _gemsInGrid[cellIndex];
+}
+
+APuzzleGem* UPuzzleGridComponent::GetGemAt(FIntPoint grid_cell)
+{
+	const int cellIndex = GetCellIndex(grid_cell);
+	if (cellIndex == INDEX_NONE)
+		return nullptr;
+	return _gemsInGrid[cellIndex];
 }
 
 void UPuzzleGridComponent::SetGemAt(FVector2D grid_index, APuzzleGem* gem)
 {
-	if (_gemsInGrid.Contains(grid_index))
-		_gemsInGrid[grid_index] = gem;
+	SetGemAt(FIntPoint((int32)grid_index.X, (int32)grid_index.Y), gem);
+}
+
+void UPuzzleGridComponent::SetGemAt(FIntPoint grid_cell, APuzzleGem* gem)
+{
+	const int cellIndex = GetCellIndex(grid_cell);
+	if (cellIndex == INDEX_NONE)
+		return;
+	_gemsInGrid[cellIndex] = gem;
+	MarkCellDirty(grid_cell);
 }
 
 APuzzleGem* UPuzzleGridComponent::GetRecycledGem(float deltaTime)
@@ -330,10 +876,40 @@ APuzzleGem* UPuzzleGridComponent::GetRecycledGem(float deltaTime)
 	gem->OnGotSpawn_Internal();
 	OnGemSpawned(gem, false);
 	_gemsRecyclerBin.RemoveAt(_gemsRecyclerBin.Num() - 1);
+	SetGemInSlotSet(gem, _recycledSlots, false);
 	gem->GemState = EGemState::none;
 	return gem;
 }
 
+int UPuzzleGridComponent::GetRecycledGems(int count, float deltaTime, TArray<APuzzleGem*>& gems)
+{
+	int added = 0;
+	for (; added < count; added++)
+	{
+		const auto gem = GetRecycledGem(deltaTime);
+		if (!gem)
+			break;
+		gems.Add(gem);
+	}
+	return added;
+}
+
+bool UPuzzleGridComponent::IsGemInSlotSet(const APuzzleGem* gem, const TBitArray<>& slots,
+                                          const TArray<APuzzleGem*>& fallback) const
+{
+	const int slot = gem->GetGemSlot();
+	if (_gemsAll.IsValidIndex(slot) && slots.IsValidIndex(slot) && _gemsAll[slot] == gem)
+		return slots[slot];
+	return fallback.Contains(gem);
+}
+
+void UPuzzleGridComponent::SetGemInSlotSet(const APuzzleGem* gem, TBitArray<>& slots, bool value)
+{
+	const int slot = gem->GetGemSlot();
+	if (_gemsAll.IsValidIndex(slot) && slots.IsValidIndex(slot) && _gemsAll[slot] == gem)
+		slots[slot] = value;
+}
+
 void UPuzzleGridComponent::HandleGemToDelete(float delta)
 {
 	if (_gemToBeDestroyed.Num() <= 0)
@@ -344,6 +920,7 @@ void UPuzzleGridComponent::HandleGemToDelete(float delta)
 		{
 			if (DeleteGem_Internal(_gemToBeDestroyed[i]))
 			{
+				SetGemInSlotSet(_gemToBeDestroyed[i], _pendingDeletionSlots, false);
 				_gemToBeDestroyed.RemoveAt(i);
 			}
 		}
@@ -352,13 +929,15 @@ void UPuzzleGridComponent::HandleGemToDelete(float delta)
 
 void UPuzzleGridComponent::DeleteGem(APuzzleGem* gem)
 {
-	if (gem && !_gemToBeDestroyed.Contains(gem))
+	if (gem && !IsGemInSlotSet(gem, _pendingDeletionSlots, _gemToBeDestroyed))
 	{
 		if (!gem->CanDeleteGem())
 			return;
-		_gemToBeDestroyed.AddUnique(gem);
+		_gemToBeDestroyed.Add(gem);
+		SetGemInSlotSet(gem, _pendingDeletionSlots, true);
 		gem->OnMarkedForDestroy();
 		gem->GemState = EGemState::pendingDeletion;
+		MarkCellDirty(gem->GridCell);
 	}
 }
 
@@ -366,20 +945,19 @@ bool UPuzzleGridComponent::DeleteGem_Internal(APuzzleGem* gem)
 {
 	if (!gem)
 		return false;
-	if (_gemsRecyclerBin.Contains(gem))
+	if (IsGemInSlotSet(gem, _recycledSlots, _gemsRecyclerBin))
 		return false;
 
-	UpdateSwapHistory(gem->GridIndex, true);
-	_gemsRecyclerBin.AddUnique(gem);
-	SetGemAt(gem->GridIndex, nullptr);
+	UpdateSwapHistory(gem->GridCell, true);
+	_gemsRecyclerBin.Add(gem);
+	SetGemInSlotSet(gem, _recycledSlots, true);
+	RequeueLaneRefills();
+	SetGemAt(gem->GridCell, nullptr);
 	OnGemDeleted(gem);
 	gem->OnGotDeleted_Internal();
-	if (_lanesInGrid.IsValidIndex(gem->GridIndex.X))
+	if (const auto node = GetNodeAt(gem->GridCell))
 	{
-		if (const auto node = _lanesInGrid[gem->GridIndex.X]->GetNodeAtIndex(gem->GridIndex.Y))
-		{
-			node->DetachGem(true);
-		}
+		node->DetachGem(true);
 	}
 	return true;
 }
@@ -390,7 +968,7 @@ bool UPuzzleGridComponent::IsGemPendingDeletion(APuzzleGem* gem)
 		return false;
 	if (_gemToBeDestroyed.Num() <= 0)
 		return false;
-	return _gemToBeDestroyed.Contains(gem);
+	return IsGemInSlotSet(gem, _pendingDeletionSlots, _gemToBeDestroyed);
 }
 
 void UPuzzleGridComponent::OnGemDeleted_Implementation(APuzzleGem* gem)
@@ -409,11 +987,15 @@ void UPuzzleGridComponent::HandleSelected(FGemSwapHandler swap)
 		{
 			_lastSelectedGem->OnGotSelectionReleased();
 			_lastSelectedGem->GemState = EGemState::falling;
+			//The node settles the gem back
+			WakeNodeAt(_lastSelectedGem->GridCell);
+			MarkCellDirty(_lastSelectedGem->GridCell);
 		}
 		if (swap.GemA && swap.GemA->GemState == EGemState::idle && swap.GemA->CanSelectGem())
 		{
 			swap.GemA->OnGotSelected();
 			swap.GemA->GemState = EGemState::selected;
+			MarkCellDirty(swap.GemA->GridCell);
 		}
 
 		_lastSelectedGem = swap.GemA;
@@ -432,9 +1014,18 @@ bool UPuzzleGridComponent::SpawnGemCondition_Implementation(APuzzleGem* gemReque
 
 UPuzzleNodeComponent* UPuzzleGridComponent::GetNodeAt(FVector2D grid_index)
 {
-	if (!_lanesInGrid.IsValidIndex(grid_index.X))
+	const int cellIndex = GetCellIndex(grid_index);
+	if (cellIndex == INDEX_NONE)
 		return nullptr;
-	return _lanesInGrid[grid_index.X]->GetNodeAtIndex(grid_index.Y);
+	return _nodesInGrid[cellIndex];
+}
+
+UPuzzleNodeComponent* UPuzzleGridComponent::GetNodeAt(FIntPoint grid_cell)
+{
+	const int cellIndex = GetCellIndex(grid_cell);
+	if (cellIndex == INDEX_NONE)
+		return nullptr;
+	return _nodesInGrid[cellIndex];
 }
 
 
@@ -446,12 +1037,82 @@ UPuzzleNodeComponent* UPuzzleGridComponent::GetNodeAt(FVector2D grid_index)
 
 FVector UPuzzleGridComponent::GetNodeDirection() const
 {
-	return GetComponentRotation().Quaternion().GetForwardVector() * _nodeDistance;
+	return _nodeDirection;
 }
 
 FVector UPuzzleGridComponent::GetLaneDirection() const
 {
-	return GetComponentRotation().Quaternion().GetRightVector() * _laneDistance;
+	return _laneDirection;
+}
+
+bool UPuzzleGridComponent::GetCellAtLocation(FVector location, FIntPoint& cell) const
+{
+	cell = FIntPoint(-1, -1);
+	const float laneSquaredDistance = _laneDirection.SquaredLength();
+	const float nodeSquaredDistance = _nodeDirection.SquaredLength();
+	if (laneSquaredDistance <= 0 || nodeSquaredDistance <= 0)
+		return false;
+	//Cell coordinates from the grid center, which sits between the middle lanes and nodes
+	const FVector local = location - GetComponentLocation();
+	const float lane = FVector::DotProduct(local, _laneDirection) / laneSquaredDistance + (_laneCount - 1) * 0.5f;
+	const float node = FVector::DotProduct(local, _nodeDirection) / nodeSquaredDistance + (_laneLength - 1) * 0.5f;
+	cell = FIntPoint(FMath::RoundToInt(lane), FMath::RoundToInt(node));
+	return GetCellIndex(cell) != INDEX_NONE;
+}
+
+bool UPuzzleGridComponent::GetCellFromRay(FVector origin, FVector direction, FIntPoint& cell) const
+{
+	cell = FIntPoint(-1, -1);
+	const float alignment = FVector::DotProduct(direction, _gridNormal);
+	if (FMath::IsNearlyZero(alignment))
+		return false;
+	const float distance = FVector::DotProduct(GetComponentLocation() - origin, _gridNormal) / alignment;
+	if (distance < 0)
+		return false;
+	return GetCellAtLocation(origin + direction * distance, cell);
+}
+
+bool UPuzzleGridComponent::GetCellFromRay(FVector origin, FVector direction, FVector2D& cell) const
+{
+	FIntPoint gridCell;
+	const bool isInGrid = GetCellFromRay(origin, direction, gridCell);
+	cell = FVector2D(gridCell.X, gridCell.Y);
+	return isInGrid;
+}
+
+bool UPuzzleGridComponent::GetCellFromScreen(APlayerController* player, FVector2D screenPosition,
+                                             FVector2D& cell) const
+{
+	cell = FVector2D(-1, -1);
+	FVector origin;
+	FVector direction;
+	if (!player || !player->DeprojectScreenPositionToWorld(screenPosition.X, screenPosition.Y, origin, direction))
+		return false;
+	return GetCellFromRay(origin, direction, cell);
+}
+
+APuzzleGem* UPuzzleGridComponent::GetGemFromRay(FVector origin, FVector direction)
+{
+	FIntPoint cell;
+	if (!GetCellFromRay(origin, direction, cell))
+		return nullptr;
+	return _gemsInGrid[GetCellIndex(cell)];
+}
+
+void UPuzzleGridComponent::RefreshGridBasis()
+{
+	const FQuat rotation = GetComponentQuat();
+	_nodeDirection = rotation.GetForwardVector() * _nodeDistance;
+	_laneDirection = rotation.GetRightVector() * _laneDistance;
+	_nodeAxis = _nodeDirection.GetSafeNormal();
+	_laneAxis = _laneDirection.GetSafeNormal();
+	_gridNormal = FVector::CrossProduct(_nodeDirection, _laneDirection).GetSafeNormal();
+	//Nodes move with the grid, their own transform is not updated yet
+	for (const auto node : _nodesInGrid)
+	{
+		if (node)
+			node->MarkSpawnLocationStale();
+	}
 }
 
 
@@ -462,6 +1123,19 @@ FVector UPuzzleGridComponent::GetLaneDirection() const
 
 
 bool UPuzzleGridComponent::CheckMatchAroundPosition(FVector2D position, TArray<FVector2D>& matchPositions)
+{
+	TArray<FIntPoint> cellPositions;
+	cellPositions.Reserve(matchPositions.Num());
+	for (const auto pos : matchPositions)
+		cellPositions.Add(FIntPoint((int32)pos.X, (int32)pos.Y));
+	const bool result = CheckMatchAroundPosition(FIntPoint((int32)position.X, (int32)position.Y), cellPositions);
+	matchPositions.Reset(cellPositions.Num());
+	for (const auto cell : cellPositions)
+		matchPositions.Add(FVector2D(cell.X, cell.Y));
+	return result;
+}
+
+bool UPuzzleGridComponent::CheckMatchAroundPosition(FIntPoint position, TArray<FIntPoint>& matchPositions)
 {
 	auto positionGem = GetGemAt(position);
 	if (!positionGem)
@@ -471,9 +1145,9 @@ bool UPuzzleGridComponent::CheckMatchAroundPosition(FVector2D position, TArray<F
 	{
 		int countHorizontal = 0;
 		//Check right
-		for (int i = position.X + 1; i < GridSize.X; i++)
+		for (int i = position.X + 1; i < _laneCount; i++)
 		{
-			auto gem = GetGemAt(FVector2D(i, position.Y));
+			auto gem = GetGemAt(FIntPoint(i, position.Y));
 			if (!gem)
 				break;
 			if (!gem->CanMatchGem())
@@ -481,12 +1155,12 @@ bool UPuzzleGridComponent::CheckMatchAroundPosition(FVector2D position, TArray<F
 			if (!positionGem->CompareGemTo(gem))
 				break;
 			countHorizontal++;
-			matchPositions.AddUnique(FVector2D(i, position.Y));
+			matchPositions.AddUnique(FIntPoint(i, position.Y));
 		}
 		//Check Left
 		for (int i = position.X - 1; i >= 0; i--)
 		{
-			auto gem = GetGemAt(FVector2D(i, position.Y));
+			auto gem = GetGemAt(FIntPoint(i, position.Y));
 			if (!gem)
 				break;
 			if (!gem->CanMatchGem())
@@ -494,7 +1168,7 @@ bool UPuzzleGridComponent::CheckMatchAroundPosition(FVector2D position, TArray<F
 			if (!positionGem->CompareGemTo(gem))
 				break;
 			countHorizontal++;
-			matchPositions.AddUnique(FVector2D(i, position.Y));
+			matchPositions.AddUnique(FIntPoint(i, position.Y));
 		}
 		//Not enough matches?
 		if (countHorizontal < 2)
@@ -512,9 +1186,9 @@ bool UPuzzleGridComponent::CheckMatchAroundPosition(FVector2D position, TArray<F
 	{
 		int countVertical = 0;
 		//Check up
-		for (int i = position.Y + 1; i < GridSize.Y; i++)
+		for (int i = position.Y + 1; i < _laneLength; i++)
 		{
-			auto gem = GetGemAt(FVector2D(position.X, i));
+			auto gem = GetGemAt(FIntPoint(position.X, i));
 			if (!gem)
 				break;
 			if (!gem->CanMatchGem())
@@ -522,12 +1196,12 @@ bool UPuzzleGridComponent::CheckMatchAroundPosition(FVector2D position, TArray<F
 			if (!positionGem->CompareGemTo(gem))
 				break;
 			countVertical++;
-			matchPositions.AddUnique(FVector2D(position.X, i));
+			matchPositions.AddUnique(FIntPoint(position.X, i));
 		}
 		//Check Down
 		for (int i = position.Y - 1; i >= 0; i--)
 		{
-			auto gem = GetGemAt(FVector2D(position.X, i));
+			auto gem = GetGemAt(FIntPoint(position.X, i));
 			if (!gem)
 				break;
 			if (!gem->CanMatchGem())
@@ -535,7 +1209,7 @@ bool UPuzzleGridComponent::CheckMatchAroundPosition(FVector2D position, TArray<F
 			if (!positionGem->CompareGemTo(gem))
 				break;
 			countVertical++;
-			matchPositions.AddUnique(FVector2D(position.X, i));
+			matchPositions.AddUnique(FIntPoint(position.X, i));
 		}
 		//Not enough matches?
 		if (countVertical < 2)
@@ -559,99 +1233,171 @@ bool UPuzzleGridComponent::CheckMatchAroundPosition(FVector2D position, TArray<F
 }
 
 
-bool UPuzzleGridComponent::CheckMatchesInLine(TArray<FVector2D> positions, TArray<FVector2D>& tempPositionBuffer,
+bool UPuzzleGridComponent::CheckMatchesInLine(const TArray<FVector2D>& positions, TArray<FVector2D>& tempPositionBuffer,
                                               TArray<FGridMatch>& resultingMatches, int minPositionsCountForMatch)
+{
+	_multiPurposePositionBuffer_1.Reset(positions.Num());
+	for (const auto pos : positions)
+		_multiPurposePositionBuffer_1.Add(FIntPoint((int32)pos.X, (int32)pos.Y));
+	_scratchMatchArena.Reset();
+	if (!CheckMatchesInLine(_multiPurposePositionBuffer_1, _scratchMatchArena, minPositionsCountForMatch))
+		return false;
+
+	//The temp buffer holds the last match found, as it used to
+	const auto lastMatch = _scratchMatchArena.GetMatch(_scratchMatchArena.Num() - 1);
+	tempPositionBuffer.Reset(lastMatch.Num());
+	for (const auto cell : lastMatch)
+		tempPositionBuffer.Add(FVector2D(cell.X, cell.Y));
+	for (int i = 0; i < _scratchMatchArena.Num(); i++)
+		resultingMatches.Add(FGridMatch(_scratchMatchArena.GetMatch(i)));
+	return true;
+}
+
+
+bool UPuzzleGridComponent::CheckMatchesInLine(TArrayView<const FIntPoint> positions, FGridMatchArena& resultingMatches,
+                                              int minPositionsCountForMatch)
 {
 	if (positions.Num() <= 0)
 		return false;
 	const int matchesCountOnStart = resultingMatches.Num();
-	int startMatchIndex = -1;
-	TArray<FVector2D> tempPositionArray;
-	for (int i = 1; i < positions.Num(); i++)
+	const int minCount = FMath::Max(minPositionsCountForMatch, 2);
+	int runStart = 0;
+	for (int i = 1; i <= positions.Num(); i++)
 	{
-		const auto last_gem = GetGemAt(positions[i - 1]);
-		const auto gem = GetGemAt(positions[i]);
-
-		//Check last gem could be match
-		if (!last_gem || !last_gem->CanMatchGem())
+		//Extend the run while the gems match
+		if (i < positions.Num())
 		{
-			//Collect - 1
-			if (startMatchIndex >= 0 && FMath::Abs(i - startMatchIndex) > (minPositionsCountForMatch - 1))
-			{
-				tempPositionBuffer.Empty();
-				for (int j = startMatchIndex; j < i; j++)
-					tempPositionBuffer.Add(positions[j]);
-				resultingMatches.Add(FGridMatch(tempPositionBuffer, _swapHistory));
-			}
-			startMatchIndex = -1;
-			continue;
+			const auto last_gem = GetGemAt(positions[i - 1]);
+			const auto gem = GetGemAt(positions[i]);
+			if (last_gem && gem && last_gem->CanMatchGem() && gem->CanMatchGem() && last_gem->CompareGemTo(gem))
+				continue;
 		}
 
-		//Check gem if valid
-		if (!gem)
+		//Collect the run ending on the previous position
+		if (i - runStart >= minCount)
 		{
-			//Collect - 1
-			if (startMatchIndex >= 0 && FMath::Abs(i - startMatchIndex) > (minPositionsCountForMatch - 1))
-			{
-				tempPositionBuffer.Empty();
-				for (int j = startMatchIndex; j < i; j++)
-					tempPositionBuffer.Add(positions[j]);
-				resultingMatches.Add(FGridMatch(tempPositionBuffer, _swapHistory));
-			}
-			startMatchIndex = -1;
-			continue;
+			resultingMatches.BeginMatch();
+			for (int j = runStart; j < i; j++)
+				resultingMatches.AddCell(positions[j]);
+			EndSwapOrderedMatch(resultingMatches);
 		}
+		runStart = i;
+	}
 
+	return resultingMatches.Num() > matchesCountOnStart;
+}
+
+
+bool UPuzzleGridComponent::FindGridMatchesWithBitboard(FGridMatchArena& resultingMatches)
+{
+	if (!_matchBitboard.Reset(_laneCount, _laneLength))
+		return false;
 
-		//Check gem could be match
-		if (!gem->CanMatchGem())
+	//Fill the bitboard with the type of every matchable gem crossed by a changed line
+	_gemTypeRepresentatives.Reset();
+	_gemTypeRepresentativeKeys.Reset();
+	for (int i = 0; i < _laneCount; i++)
+	{
+		const bool laneDirty = _dirtyLanes[i];
+		for (int j = 0; j < _laneLength; j++)
 		{
-			//Collect - 1
-			if (startMatchIndex >= 0 && FMath::Abs(i - startMatchIndex) > (minPositionsCountForMatch - 1))
-			{
-				tempPositionBuffer.Empty();
-				for (int j = startMatchIndex; j < i; j++)
-					tempPositionBuffer.Add(positions[j]);
-				resultingMatches.Add(FGridMatch(tempPositionBuffer, _swapHistory));
-			}
-			startMatchIndex = -1;
-			continue;
+			if (!laneDirty && !_dirtyRows[j])
+				continue;
+			const auto gem = _gemsInGrid[GetCellIndex(i, j)];
+			if (!gem || !gem->CanMatchGem())
+				continue;
+			_matchBitboard.SetCell(i, j, GetGemTypeSlot(gem));
 		}
+	}
 
-		//Check last and current gem's equatables
-		if (!last_gem->CompareGemTo(gem))
+	//Vertical Matches
+	for (int i = 0; i < _laneCount; i++)
+	{
+		if (!_dirtyLanes[i])
+			continue;
+		_bitboardRunsBuffer.Reset();
+		_matchBitboard.FindLaneRuns(i, MinMatchCount, _bitboardRunsBuffer);
+		for (const auto run : _bitboardRunsBuffer)
 		{
-			//Collect - 1
-			if (startMatchIndex >= 0 && FMath::Abs(i - startMatchIndex) > (minPositionsCountForMatch - 1))
-			{
-				tempPositionBuffer.Empty();
-				for (int j = startMatchIndex; j < i; j++)
-					tempPositionBuffer.Add(positions[j]);
-				resultingMatches.Add(FGridMatch(tempPositionBuffer, _swapHistory));
-			}
-			startMatchIndex = -1;
+			resultingMatches.BeginMatch();
+			for (int j = run.X; j <= run.Y; j++)
+				resultingMatches.AddCell(FIntPoint(i, j));
+			EndSwapOrderedMatch(resultingMatches);
+		}
+	}
+
+	//Horizontal Matches
+	for (int j = 0; j < _laneLength; j++)
+	{
+		if (!_dirtyRows[j])
 			continue;
+		_bitboardRunsBuffer.Reset();
+		_matchBitboard.FindRowRuns(j, MinMatchCount, _bitboardRunsBuffer);
+		for (const auto run : _bitboardRunsBuffer)
+		{
+			resultingMatches.BeginMatch();
+			for (int i = run.X; i <= run.Y; i++)
+				resultingMatches.AddCell(FIntPoint(i, j));
+			EndSwapOrderedMatch(resultingMatches);
 		}
+	}
+	return true;
+}
+
+
+void UPuzzleGridComponent::EndSwapOrderedMatch(FGridMatchArena& resultingMatches)
+{
+	const int matchIndex = resultingMatches.EndMatch();
+	if (matchIndex == INDEX_NONE)
+		return;
+	//The earliest swapped position goes last
+	const TArrayView<FIntPoint> positions = resultingMatches.GetMatchMutable(matchIndex);
+	int lowestPriority = MAX_int32;
+	int swappedPosition = INDEX_NONE;
+	for (int i = 0; i < positions.Num(); i++)
+	{
+		const int priority = GetSwapPriority(positions[i]);
+		if (priority >= lowestPriority)
+			continue;
+		lowestPriority = priority;
+		swappedPosition = i;
+	}
+	FGridMatch::MovePositionToEnd(positions, swappedPosition);
+}
+
 
-		//Equatable test passed
-		if (startMatchIndex < 0) //Set start index at last gem one if invalid index
-			startMatchIndex = i - 1;
+int UPuzzleGridComponent::GetGemTypeSlot(APuzzleGem* gem)
+{
+	//Gems without equatable match with everything
+	if (!gem || !gem->GetGemEquatable())
+		return FPuzzleMatchBitboard::WildcardType;
 
-		//Collect for the last item
-		if (i >= (positions.Num() - 1))
+	//Keyed gems only need an integer lookup
+	const int typeKey = gem->GetGemTypeKey();
+	if (typeKey != INDEX_NONE)
+	{
+		const int slot = _gemTypeRepresentativeKeys.IndexOfByKey(typeKey);
+		if (slot != INDEX_NONE)
+			return slot;
+		//Equatables without key can still equal keyed ones. the first one found takes the key
+		for (int i = 0; i < _gemTypeRepresentatives.Num(); i++)
 		{
-			//Collect full
-			if (startMatchIndex >= 0 && FMath::Abs(i - startMatchIndex) >= (minPositionsCountForMatch - 1))
-			{
-				tempPositionBuffer.Empty();
-				for (int j = startMatchIndex; j <= i; j++)
-					tempPositionBuffer.Add(positions[j]);
-				resultingMatches.Add(FGridMatch(tempPositionBuffer, _swapHistory));
-			}
+			if (_gemTypeRepresentativeKeys[i] != INDEX_NONE || !gem->CompareGemTo(_gemTypeRepresentatives[i]))
+				continue;
+			_gemTypeRepresentativeKeys[i] = typeKey;
+			return i;
 		}
 	}
-
-	return FMath::Abs(resultingMatches.Num() - matchesCountOnStart) > 0;
+	else
+	{
+		for (int i = 0; i < _gemTypeRepresentatives.Num(); i++)
+		{
+			if (gem->CompareGemTo(_gemTypeRepresentatives[i]))
+				return i;
+		}
+	}
+	_gemTypeRepresentativeKeys.Add(typeKey);
+	return _gemTypeRepresentatives.Add(gem);
 }
 
 
@@ -659,33 +1405,125 @@ void UPuzzleGridComponent::CompactMatchesOnIntersections(TArray<FGridMatch>& res
 {
 	if (resultingMatches.Num() <= 0)
 		return;
+	_scratchMatchArena.FromGridMatches(resultingMatches);
+	CompactMatchesOnIntersections(_scratchMatchArena);
+	_scratchMatchArena.ToGridMatches(resultingMatches);
+}
+
 
-	//Check intersection matches
+void UPuzzleGridComponent::CompactMatchesOnIntersections(FGridMatchArena& resultingMatches)
+{
+	if (resultingMatches.Num() <= 0)
+		return;
+
+	//Find the root of a match, halving the path on the way
+	auto findRoot = [this](int match) -> int
 	{
-		const int currentLenght = resultingMatches.Num();
-		for (int i = currentLenght - 1; i >= 0; i--)
+		while (_matchUnionParents[match] != match)
 		{
-			for (int j = currentLenght - 1; j >= 0; j--)
+			_matchUnionParents[match] = _matchUnionParents[_matchUnionParents[match]];
+			match = _matchUnionParents[match];
+		}
+		return match;
+	};
+
+	//Keep the intersection cell swapped first, or the first one found
+	auto preferIntersection = [this](FIntPoint current, FIntPoint candidate) -> FIntPoint
+	{
+		if (current.X < 0)
+			return candidate;
+		if (candidate.X < 0)
+			return current;
+		return GetSwapPriority(candidate) < GetSwapPriority(current) ? candidate : current;
+	};
+
+	//Union matches sharing a cell, in one pass over every match cell
+	const int matchCount = resultingMatches.Num();
+	_matchUnionParents.SetNumUninitialized(matchCount);
+	_matchUnionIntersections.SetNumUninitialized(matchCount);
+	for (int i = 0; i < matchCount; i++)
+	{
+		_matchUnionParents[i] = i;
+		_matchUnionIntersections[i] = FIntPoint(-1, -1);
+	}
+	_cellMatchOwners.Init(INDEX_NONE, _laneCount * _laneLength);
+	for (int i = matchCount - 1; i >= 0; i--)
+	{
+		for (const auto cell : resultingMatches.GetMatch(i))
+		{
+			const int cellIndex = GetCellIndex(cell);
+			if (cellIndex == INDEX_NONE)
+				continue;
+			const int owner = _cellMatchOwners[cellIndex];
+			if (owner == INDEX_NONE)
 			{
-				if (i == j)
-					continue;
-				FGridMatch intersectMatch;
-				if (MergeMatches(resultingMatches[i], resultingMatches[j], intersectMatch))
-				{
-					resultingMatches.Add(intersectMatch);
-				}
+				_cellMatchOwners[cellIndex] = i;
+				continue;
 			}
+			const int rootA = findRoot(owner);
+			const int rootB = findRoot(i);
+			FIntPoint intersection = preferIntersection(_matchUnionIntersections[rootA], _matchUnionIntersections[rootB]);
+			_matchUnionParents[rootB] = rootA;
+			_matchUnionIntersections[rootA] = preferIntersection(intersection, cell);
 		}
 	}
 
-	//Remove empty matches
+	//Chain the members of every union, in descending match order
+	_matchUnionNext.SetNumUninitialized(matchCount);
+	_matchUnionHeads.SetNumUninitialized(matchCount);
+	for (int i = 0; i < matchCount; i++)
+		_matchUnionHeads[i] = INDEX_NONE;
+	for (int i = 0; i < matchCount; i++)
+	{
+		const int root = findRoot(i);
+		_matchUnionNext[i] = _matchUnionHeads[root];
+		_matchUnionHeads[root] = i;
+	}
+
+	//Keep lone matches in place, then append merged matches with their intersection at the end
+	_compactedSpansBuffer.Reset();
+	for (int i = 0; i < matchCount; i++)
+	{
+		if (_matchUnionIntersections[findRoot(i)].X >= 0)
+			continue;
+		_compactedSpansBuffer.Add(resultingMatches.GetSpan(i));
+	}
+	for (int i = matchCount - 1; i >= 0; i--)
 	{
-		for (int i = resultingMatches.Num() - 1; i >= 0; i--)
+		const int root = findRoot(i);
+		const FIntPoint intersection = _matchUnionIntersections[root];
+		if (intersection.X < 0 || _matchUnionHeads[root] != i)
+			continue;
+
+		//Merged cells are appended to the arena, so members are read by cell index rather than by view
+		FGridMatchArena::FSpan& merged = _compactedSpansBuffer.AddDefaulted_GetRef();
+		merged.First = resultingMatches.NumCells();
+		for (int member = i; member != INDEX_NONE; member = _matchUnionNext[member])
 		{
-			if (resultingMatches[i].IsEmpty())
-				resultingMatches.RemoveAt(i);
+			const FGridMatchArena::FSpan memberSpan = resultingMatches.GetSpan(member);
+			for (int c = memberSpan.First; c < memberSpan.First + memberSpan.Num; c++)
+			{
+				const FIntPoint cell = resultingMatches.GetCell(c);
+				const int cellIndex = GetCellIndex(cell);
+				if (cell == intersection || cellIndex == INDEX_NONE || _cellMatchOwners[cellIndex] == INDEX_NONE)
+					continue;
+				_cellMatchOwners[cellIndex] = INDEX_NONE;
+				resultingMatches.AddCell(cell);
+			}
 		}
+		resultingMatches.AddCell(intersection);
+		merged.Num = resultingMatches.NumCells() - merged.First;
 	}
+	resultingMatches.SwapSpans(_compactedSpansBuffer);
+}
+
+
+int UPuzzleGridComponent::GetSwapPriority(FIntPoint cell) const
+{
+	const int cellIndex = GetCellIndex(cell);
+	if (cellIndex == INDEX_NONE || _swapSequences[cellIndex] <= 0)
+		return MAX_int32;
+	return _swapSequences[cellIndex];
 }
 
 
@@ -696,8 +1534,8 @@ bool UPuzzleGridComponent::MergeMatches(FGridMatch& match_A, FGridMatch& match_B
 	const auto intersection = match_A.Intersect(match_B);
 	if (intersection.X < 0 || intersection.Y < 0)
 		return false;
-	const int index_A = (int)intersection.X;
-	const int index_B = (int)intersection.Y;
+	const int index_A = intersection.X;
+	const int index_B = intersection.Y;
 	if (!match_A.MatchPositions.IsValidIndex(index_A))
 		return false;
 	if (!match_B.MatchPositions.IsValidIndex(index_B))
@@ -717,11 +1555,28 @@ bool UPuzzleGridComponent::MergeMatches(FGridMatch& match_A, FGridMatch& match_B
 }
 
 
-bool UPuzzleGridComponent::CanDestroyMatch(FGridMatch& match, TArray<FVector2D> exceptionList)
+bool UPuzzleGridComponent::CanDestroyMatch(const FGridMatch& match, const TArray<FVector2D>& exceptionList)
 {
 	if (match.MatchPositions.Num() <= 0)
 		return false;
-	for (auto position : match.MatchPositions)
+	for (const auto position : match.MatchPositions)
+	{
+		auto gem = GetGemAt(position);
+		if (!gem)
+			continue;
+		if (!exceptionList.Contains(position) && gem->GemState != idle)
+			return false;
+	}
+
+	return true;
+}
+
+
+bool UPuzzleGridComponent::CanDestroyMatch(TArrayView<const FIntPoint> match, TArrayView<const FIntPoint> exceptionList)
+{
+	if (match.Num() <= 0)
+		return false;
+	for (const auto position : match)
 	{
 		auto gem = GetGemAt(position);
 		if (!gem)
@@ -739,67 +1594,82 @@ void UPuzzleGridComponent::OnSwapEnded_Implementation(bool swapResult, FVector2D
 }
 
 
-void UPuzzleGridComponent::HandleGridMatches(TArray<FVector2D>& exceptionPositions)
+void UPuzzleGridComponent::HandleGridMatches(TArray<FIntPoint>& exceptionPositions)
 {
-	_allGridMatches.Empty();
+	//Nothing changed on the grid since the last scan
+	if (!_isGridDirty)
+	{
+		exceptionPositions.Reset();
+		return;
+	}
 
-	//Search grid for matches
+	_matchArena.Reset();
 
-	//Vertical Matches
+	//Search grid for matches, falling back to the line scan when the grid is too large for the bitboard
+	if (!FindGridMatchesWithBitboard(_matchArena))
 	{
-		for (int i = 0; i < GridSize.X; i++)
+		//Vertical Matches
 		{
-			//collect line
-			_multiPurposePositionBuffer_1.Empty();
-			for (int j = 0; j < GridSize.Y; j++)
+			for (int i = 0; i < _laneCount; i++)
 			{
-				FVector2D position = FVector2D(i, j);
-				_multiPurposePositionBuffer_1.AddUnique(position);
-			}
+				if (!_dirtyLanes.IsValidIndex(i) || !_dirtyLanes[i])
+					continue;
 
-			//Check matches in line
-			CheckMatchesInLine(_multiPurposePositionBuffer_1, _multiPurposePositionBuffer_2, _allGridMatches,
-			                   MinMatchCount);
+				//collect line
+				_multiPurposePositionBuffer_1.Reset();
+				for (int j = 0; j < _laneLength; j++)
+					_multiPurposePositionBuffer_1.Add(FIntPoint(i, j));
+
+				//Check matches in line
+				CheckMatchesInLine(_multiPurposePositionBuffer_1, _matchArena, MinMatchCount);
+			}
 		}
-	}
 
-	//Horizontal Matches
-	{
-		for (int i = 0; i < GridSize.Y; i++)
+		//Horizontal Matches
 		{
-			//collect line
-			_multiPurposePositionBuffer_1.Empty();
-			for (int j = 0; j < GridSize.X; j++)
+			for (int i = 0; i < _laneLength; i++)
 			{
-				FVector2D position = FVector2D(j, i);
-				_multiPurposePositionBuffer_1.AddUnique(position);
-			}
+				if (!_dirtyRows.IsValidIndex(i) || !_dirtyRows[i])
+					continue;
 
-			//Check matches in line
-			CheckMatchesInLine(_multiPurposePositionBuffer_1, _multiPurposePositionBuffer_2, _allGridMatches,
-			                   MinMatchCount);
+				//collect line
+				_multiPurposePositionBuffer_1.Reset();
+				for (int j = 0; j < _laneCount; j++)
+					_multiPurposePositionBuffer_1.Add(FIntPoint(j, i));
+
+				//Check matches in line
+				CheckMatchesInLine(_multiPurposePositionBuffer_1, _matchArena, MinMatchCount);
+			}
 		}
 	}
 
+	//Every changed line got scanned
+	if (_laneCount > 0)
+		_dirtyLanes.SetRange(0, _laneCount, false);
+	if (_laneLength > 0)
+		_dirtyRows.SetRange(0, _laneLength, false);
+	_isGridDirty = false;
+
 	//Handle intersections
-	CompactMatchesOnIntersections(_allGridMatches);
+	CompactMatchesOnIntersections(_matchArena);
 
 	//Destroy Matches
 	{
-		exceptionPositions.Empty();
-		if (_allGridMatches.Num() <= 0)
+		exceptionPositions.Reset();
+		if (_matchArena.Num() <= 0)
 			return;
-		for (auto match : _allGridMatches)
+		for (int m = 0; m < _matchArena.Num(); m++)
 		{
+			const auto match = _matchArena.GetMatch(m);
 			if (!CanDestroyMatch(match, exceptionPositions))
 				continue;
-			for (int i = 0; i < match.MatchPositions.Num(); i++)
+			const int matchCount = match.Num();
+			for (int i = 0; i < matchCount; i++)
 			{
-				const auto gem = GetGemAt(match.MatchPositions[i]);
+				const auto gem = GetGemAt(match[i]);
 				if (!gem)
 					continue;
-				const int matchCount = match.MatchPositions.Num();
-				const bool intersection = i == (match.MatchPositions.Num() - 1) && matchCount > MinMatchCount;
+				const bool intersection = i == (matchCount - 1) && matchCount > MinMatchCount;
 				if (gem->AvoidDestroyOnGemMatching(matchCount, intersection))
 					continue;
 				DeleteGem(gem);
@@ -809,24 +1679,136 @@ void UPuzzleGridComponent::HandleGridMatches(TArray<FVector2D>& exceptionPositio
 }
 
 
-void UPuzzleGridComponent::UpdateSwapHistory(FVector2D gemPosition, bool removeOperation)
+void UPuzzleGridComponent::UpdateSwapHistory(FIntPoint gemPosition, bool removeOperation)
 {
-	int indexInHistory = _swapHistory.IndexOfByPredicate([gemPosition](FVector2D historyItem)-> bool
-	{
-		return historyItem == gemPosition;
-	});
+	const int cellIndex = GetCellIndex(gemPosition);
+	if (cellIndex == INDEX_NONE)
+		return;
+	int& sequence = _swapSequences[cellIndex];
 
-	if (!_swapHistory.IsValidIndex(indexInHistory))
+	if (sequence <= 0)
 	{
-		if (!removeOperation && gemPosition.X >= 0 && gemPosition.Y >= 0)
-			_swapHistory.Add(gemPosition);
+		if (!removeOperation)
+		{
+			sequence = _nextSwapSequence++;
+			_swapHistoryCount++;
+		}
 		return;
 	}
 
 	if (!removeOperation)
 		return;
 
-	_swapHistory.RemoveAt(indexInHistory);
+	sequence = 0;
+	//Restart the numbering once the history is empty
+	if (--_swapHistoryCount <= 0)
+	{
+		_swapHistoryCount = 0;
+		_nextSwapSequence = 1;
+	}
+}
+
+
+void UPuzzleGridComponent::MarkCellDirty(FIntPoint grid_cell)
+{
+	if (GetCellIndex(grid_cell) == INDEX_NONE)
+		return;
+	_dirtyLanes[grid_cell.X] = true;
+	_dirtyRows[grid_cell.Y] = true;
+	_isGridDirty = true;
+	_isSimulationStale = true;
+}
+
+
+void UPuzzleGridComponent::MarkGridDirty()
+{
+	_dirtyLanes.Init(true, _laneCount);
+	_dirtyRows.Init(true, _laneLength);
+	_isGridDirty = _laneCount > 0 && _laneLength > 0;
+	_isSimulationStale = true;
+}
+
+#pragma endregion
+
+
+#pragma region Simulation Functions
+
+
+void UPuzzleGridComponent::CaptureSimulation(FPuzzleBoardSimulation& board)
+{
+	board.Initialize(_laneCount, _laneLength, 0, FMath::Rand());
+	_gemTypeRepresentatives.Reset();
+	_gemTypeRepresentativeKeys.Reset();
+	for (int i = 0; i < _laneCount; i++)
+	{
+		for (int j = 0; j < _laneLength; j++)
+		{
+			const auto gem = _gemsInGrid[GetCellIndex(i, j)];
+			if (!gem || gem->GemState == pendingDeletion)
+				continue;
+			FPuzzleBoardCell cell;
+			cell.Type = GetGemTypeSlot(gem);
+			cell.Capabilities = gem->GetGemCapabilities();
+			board.SetCell(FIntPoint(i, j), cell);
+		}
+	}
+	//Refilled gems get one of the types found on the grid
+	board.SetTypeCount(_gemTypeRepresentatives.Num());
+}
+
+const FPuzzleBoardSimulation& UPuzzleGridComponent::GetSimulation()
+{
+	if (_isSimulationStale)
+	{
+		CaptureSimulation(_simulation);
+		_isSimulationStale = false;
+	}
+	return _simulation;
+}
+
+bool UPuzzleGridComponent::SimulateSwap(FIntPoint cellA, FIntPoint cellB, FPuzzleBoardResolution& resolution,
+                                        FPuzzleBoardSimulation* resultBoard)
+{
+	FPuzzleBoardSimulation& board = resultBoard ? *resultBoard : _scratchSimulation;
+	board = GetSimulation();
+	return board.ResolveSwap(cellA, cellB, MinMatchCount, resolution);
+}
+
+bool UPuzzleGridComponent::SimulateSwap(FVector2D cellA, FVector2D cellB, int& cascadeSteps, int& deletedGems)
+{
+	const bool isKept = SimulateSwap(FIntPoint((int32)cellA.X, (int32)cellA.Y),
+	                                  FIntPoint((int32)cellB.X, (int32)cellB.Y), _scratchResolution);
+	cascadeSteps = _scratchResolution.Steps;
+	deletedGems = _scratchResolution.DeletedCount;
+	return isKept;
+}
+
+int UPuzzleGridComponent::FindValidMoves(TArray<FPuzzleBoardMove>& moves)
+{
+	return GetSimulation().FindValidMoves(MinMatchCount, moves);
+}
+
+bool UPuzzleGridComponent::HasAnyValidMove()
+{
+	return GetSimulation().HasAnyValidMove(MinMatchCount);
+}
+
+bool UPuzzleGridComponent::GetBestMove(FVector2D& cellA, FVector2D& cellB, int& matchSize)
+{
+	matchSize = 0;
+	_validMovesBuffer.Reset();
+	if (FindValidMoves(_validMovesBuffer) <= 0)
+		return false;
+	const FPuzzleBoardMove* best = &_validMovesBuffer[0];
+	for (const auto& move : _validMovesBuffer)
+	{
+		if (move.MatchSize > best->MatchSize)
+			best = &move;
+	}
+	cellA = FVector2D(best->CellA.X, best->CellA.Y);
+	cellB = FVector2D(best->CellB.X, best->CellB.Y);
+	matchSize = best->MatchSize;
+	return true;
 }
 
 #pragma endregion
@@ -851,13 +1833,26 @@ void UPuzzleGridComponent::BeginPlay()
 	Super::BeginPlay();
 
 	// CLear and Initialize the grid
-	if (AutoInitGrid)
+	if (AutoInitGrid && AsyncGridInit)
+	{
+		InitializeGridAsync(GridSize, NodeSize, LaneClass);
+	}
+	else if (AutoInitGrid)
 	{
 		InitializeGrid(GridSize, NodeSize, LaneClass);
 	}
 }
 
 
+// Called when the grid transform changed
+void UPuzzleGridComponent::OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	Super::OnUpdateTransform(UpdateTransformFlags, Teleport);
+
+	RefreshGridBasis();
+}
+
+
 // Called every frame
 void UPuzzleGridComponent::TickComponent(float DeltaTime, ELevelTick TickType,
                                          FActorComponentTickFunction* ThisTickFunction)
@@ -865,6 +1860,15 @@ void UPuzzleGridComponent::TickComponent(float DeltaTime, ELevelTick TickType,
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
 	// ...
+	//Time sliced init
+	if (_isGridInitializing)
+	{
+		StepGridInit(InitFrameBudget * 0.001);
+		return;
+	}
+	RetryParkedRefills(DeltaTime * _gridTimeScale);
+	if (BatchGridTick)
+		UpdateGridElements(DeltaTime);
 	auto gemSwap = HandleInputs();
 	if (gemSwap.IsValid())
 		gemSwap.isUserMadeSwap = true;
@@ -889,6 +1893,7 @@ void UPuzzleGridComponent::TickComponent(float DeltaTime, ELevelTick TickType,
 		break;
 	}
 	HandleGemToDelete(DeltaTime);
+	SyncActiveGemInstances();
 }
 
 #pragma endregion
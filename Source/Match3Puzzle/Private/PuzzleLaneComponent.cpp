@@ -26,23 +26,52 @@ void UPuzzleLaneComponent::InitializeLane(UPuzzleGridComponent* grid, int laneLe
 {
 	if (!grid)
 		return;
-	_indexInGrid = lane_index;
-	_directionToRecycler = grid->GetNodeDirection() * (laneLength + RecyclingZoneDistance);
 	_grid = grid;
-	for (int i = 0; i < laneLength; i++)
+	ResizeLane(laneLength, lane_index, innerGemPopMethod, popMethodForAll);
+}
+
+void UPuzzleLaneComponent::ResizeLane(int laneLength, int lane_index, EGridGemNodePopMethod innerGemPopMethod,
+                                      bool popMethodForAll)
+{
+	if (!_grid)
+		return;
+	_indexInGrid = lane_index;
+	_directionToRecycler = _grid->GetNodeDirection() * (laneLength + RecyclingZoneDistance);
+
+	//Delete the nodes past the new length
+	for (int i = _nodesInLane.Num() - 1; i >= laneLength; i--)
+	{
+		if (_nodesInLane[i])
+		{
+			_nodesInLane[i]->CLearNode();
+			_nodesInLane[i]->DestroyComponent();
+		}
+		_nodesInLane.RemoveAt(i);
+	}
+
+	//Create the missing ones
+	for (int i = _nodesInLane.Num(); i < laneLength; i++)
 	{
 		UPuzzleNodeComponent* instance = NewObject<UPuzzleNodeComponent>(this, NodeClass);
 		instance->SetupAttachment(this);
 		instance->RegisterComponent();
-		instance->SetWorldLocation(GetComponentLocation() + grid->GetNodeDirection() * i);
-		instance->InitializeNode(this, FVector2D(lane_index, i));
+		_nodesInLane.Add(instance);
+	}
+
+	//Place every node
+	for (int i = 0; i < laneLength; i++)
+	{
+		const auto instance = _nodesInLane[i];
+		instance->SetWorldLocation(GetComponentLocation() + _grid->GetNodeDirection() * i);
+		instance->InitializeNode(this, FIntPoint(lane_index, i));
 		if (i == 0)
 			instance->RequestGridGemMethod = popMethodForAll? innerGemPopMethod : fromBeginOfLane;
 		else if (i == (laneLength - 1))
 			instance->RequestGridGemMethod = popMethodForAll? innerGemPopMethod : fromEndOfLane;
 		else
 			instance->RequestGridGemMethod = innerGemPopMethod;
-		_nodesInLane.Add(instance);
+		instance->MarkSpawnLocationStale();
+		instance->WakeNode();
 	}
 }
 
@@ -70,8 +99,7 @@ void UPuzzleLaneComponent::SetGemInGrid(int nodeYindex, APuzzleGem* gem)
 {
 	if (!GetParentGrid())
 		return;
-	FVector2d index = FVector2d(_indexInGrid, nodeYindex);
-	GetParentGrid()->SetGemAt(index, gem);
+	GetParentGrid()->SetGemAt(FIntPoint(_indexInGrid, nodeYindex), gem);
 }
 
 void UPuzzleLaneComponent::AddForce(FVector force)
@@ -88,20 +116,149 @@ void UPuzzleLaneComponent::AddForce(FVector force)
 
 void UPuzzleLaneComponent::AddRadialForce(FVector center, float radius, float maxIntensity)
 {
-	if(_nodesInLane.Num() <= 0)
+	if(_nodesInLane.Num() <= 0 || radius <= 0)
 		return;
+	const float squaredRadius = radius * radius;
 	for(auto node:_nodesInLane)
 	{
 		if(!node)
 			continue;
-		FVector distance = node->GetComponentLocation() - center;
-		if(distance.Length() >= radius)
+		const FVector offset = node->GetComponentLocation() - center;
+		if(offset.SquaredLength() >= squaredRadius)
 			continue;
-		FVector direction = distance.GetSafeNormal();
-		auto inRange = TRange<float>(0, radius);
-		auto outRange = TRange<float>(0, 1);
-		float intensity = (1 - FMath::GetMappedRangeValueClamped(inRange, outRange, (float)direction.Length())) * maxIntensity;
-		node->AddImpulseForceToGem(direction * intensity);
+		const float distance = offset.Length();
+		const float intensity = (1 - distance / radius) * maxIntensity;
+		node->AddImpulseForceToGem(distance > 0 ? offset * (intensity / distance) : FVector::ZeroVector);
+	}
+}
+
+void UPuzzleLaneComponent::SetUsesRefillPlanner(bool usesRefillPlanner)
+{
+	_usesRefillPlanner = usesRefillPlanner;
+	MarkRefillPending();
+}
+
+void UPuzzleLaneComponent::MarkRefillPending()
+{
+	_isRefillPending = _usesRefillPlanner;
+	//Batched lanes are refilled from the grid queue
+	if (_isRefillPending && _isTickedByGrid && _grid)
+		_grid->QueueLaneRefill(_indexInGrid);
+}
+
+bool UPuzzleLaneComponent::PlanRefill(float deltaTime)
+{
+	bool isStarved = false;
+	for (int vacancies = DropGems(deltaTime); vacancies > 0 && _grid; vacancies--)
+	{
+		const auto gem = _grid->GetRecycledGem(deltaTime);
+		if (!gem)
+		{
+			isStarved = true;
+			break;
+		}
+		FillVacancies(TArrayView<APuzzleGem* const>(&gem, 1));
+	}
+	//Waiting nodes keep the lane pending, the other ones wait for the recycler
+	const bool isFull = GetVacancyCount() <= 0;
+	_isRefillPending = !isFull;
+	if (isStarved && !HasHeldNodes())
+	{
+		_isRefillPending = false;
+		_grid->ParkLaneRefill(_indexInGrid);
+	}
+	return isFull;
+}
+
+int UPuzzleLaneComponent::DropGems(float deltaTime)
+{
+	//Each gem goes straight to the lowest free node below it
+	int landing = 0;
+	int blocked = INDEX_NONE;
+	for (int j = 0; j < _nodesInLane.Num(); j++)
+	{
+		const auto node = _nodesInLane[j];
+		if (!node || !node->GetCurrentGem())
+			continue;
+		//Grid only nodes don't take gems from above
+		while (landing < j && (!_nodesInLane[landing] || _nodesInLane[landing]->IsGemFromGridOnly))
+			landing++;
+		if (landing < j)
+		{
+			//Gems that can't be detached hold the gems above them
+			const auto gem = node->DetachGem();
+			if (!gem)
+			{
+				landing = j + 1;
+				blocked = j;
+				continue;
+			}
+			_nodesInLane[landing]->AttachGem(gem);
+		}
+		landing++;
+	}
+	_spawnedSinceDrop = 0;
+
+	//Empty nodes under a blocked gem wait for it, as nodes polling their lane do
+	int vacancies = 0;
+	_heldNodes.Init(false, _nodesInLane.Num());
+	for (int j = 0; j < _nodesInLane.Num(); j++)
+	{
+		const auto node = _nodesInLane[j];
+		if (!node || node->GetCurrentGem())
+			continue;
+		if (j < blocked && !node->IsGemFromGridOnly && !node->UpdateGridDirectRequest(deltaTime))
+		{
+			_heldNodes[j] = true;
+			continue;
+		}
+		vacancies++;
+	}
+	return vacancies;
+}
+
+int UPuzzleLaneComponent::FillVacancies(TArrayView<APuzzleGem* const> gems)
+{
+	//Spawned gems are stacked above the recycler in drop order
+	int used = 0;
+	for (int j = 0; j < _nodesInLane.Num() && used < gems.Num(); j++)
+	{
+		const auto node = _nodesInLane[j];
+		if (!node || node->GetCurrentGem())
+			continue;
+		if (_heldNodes.IsValidIndex(j) && _heldNodes[j])
+			continue;
+		const auto gem = gems[used++];
+		if (_grid)
+			gem->SetActorLocation(GetLaneRecyclerLocation() + _grid->GetNodeDirection() * _spawnedSinceDrop);
+		node->AttachGem(gem, true);
+		_spawnedSinceDrop++;
+	}
+	_isRefillPending = GetVacancyCount() > 0;
+	return used;
+}
+
+int UPuzzleLaneComponent::GetVacancyCount() const
+{
+	int vacancies = 0;
+	for (const auto node : _nodesInLane)
+	{
+		if (node && !node->GetCurrentGem())
+			vacancies++;
+	}
+	return vacancies;
+}
+
+void UPuzzleLaneComponent::SetTickedByGrid(bool tickedByGrid)
+{
+	_isTickedByGrid = tickedByGrid;
+	SetComponentTickEnabled(!_isTickedByGrid || GetClass()->IsFunctionImplementedInScript(
+		GET_FUNCTION_NAME_CHECKED(UPuzzleLaneComponent, ReceiveTick)));
+	for (auto node : _nodesInLane)
+	{
+		if (!node)
+			continue;
+		node->SetTickedByGrid(tickedByGrid);
 	}
 }
 
@@ -138,6 +295,10 @@ void UPuzzleLaneComponent::TickComponent(float DeltaTime, ELevelTick TickType,
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
 	// ...
+	//The grid fills the lanes itself while initializing
+	if (_isTickedByGrid || !_isRefillPending || !_grid || _grid->IsGridInitializing())
+		return;
+	PlanRefill(_grid->GetTimeScale() * DeltaTime);
 }
 
 #pragma endregion
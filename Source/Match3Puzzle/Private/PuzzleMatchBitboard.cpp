@@ -0,0 +1,104 @@
+// Copyright © 2023 by Tyni Boat. All Rights Reserved.
+
+
+#include "PuzzleMatchBitboard.h"
+
+
+#pragma region Bitboard functions
+
+
+bool FPuzzleMatchBitboard::Reset(int laneCount, int laneLength)
+{
+	_laneCount = 0;
+	_laneLength = 0;
+	_typeCount = 0;
+	_laneMasks.Reset();
+	_rowMasks.Reset();
+	_wildcardLaneMasks.Reset();
+	_wildcardRowMasks.Reset();
+	if (laneCount <= 0 || laneLength <= 0)
+		return false;
+	if (laneCount > MaxLineLength || laneLength > MaxLineLength)
+		return false;
+
+	_laneCount = laneCount;
+	_laneLength = laneLength;
+	_wildcardLaneMasks.SetNumZeroed(_laneCount);
+	_wildcardRowMasks.SetNumZeroed(_laneLength);
+	return true;
+}
+
+void FPuzzleMatchBitboard::SetCell(int lane, int node, int typeSlot)
+{
+	if (lane < 0 || node < 0 || lane >= _laneCount || node >= _laneLength)
+		return;
+	if (typeSlot == WildcardType)
+	{
+		_wildcardLaneMasks[lane] |= 1ull << node;
+		_wildcardRowMasks[node] |= 1ull << lane;
+		return;
+	}
+	if (typeSlot < 0)
+		return;
+
+	//Grow the type masks up to the new slot
+	while (_typeCount <= typeSlot)
+	{
+		_laneMasks.AddZeroed(_laneCount);
+		_rowMasks.AddZeroed(_laneLength);
+		_typeCount++;
+	}
+	_laneMasks[typeSlot * _laneCount + lane] |= 1ull << node;
+	_rowMasks[typeSlot * _laneLength + node] |= 1ull << lane;
+}
+
+void FPuzzleMatchBitboard::FindLaneRuns(int lane, int minCount, TArray<FIntPoint>& runs) const
+{
+	if (lane < 0 || lane >= _laneCount)
+		return;
+	FindLineRuns(_laneMasks, _wildcardLaneMasks, lane, _laneCount, minCount, runs);
+}
+
+void FPuzzleMatchBitboard::FindRowRuns(int node, int minCount, TArray<FIntPoint>& runs) const
+{
+	if (node < 0 || node >= _laneLength)
+		return;
+	FindLineRuns(_rowMasks, _wildcardRowMasks, node, _laneLength, minCount, runs);
+}
+
+void FPuzzleMatchBitboard::FindLineRuns(const TArray<uint64>& typeMasks, const TArray<uint64>& wildcardMasks, int line,
+                                        int lineCount, int minCount, TArray<FIntPoint>& runs) const
+{
+	//A match needs at least two aligned gems
+	const int count = FMath::Clamp(minCount, 2, MaxLineLength);
+	const uint64 wildcards = wildcardMasks[line];
+
+	//Link each cell to the next one when they compare equal, a wildcard comparing equal to any neighbour.
+	//Runs are then chained pair by pair, the same way the line checks on gems do.
+	uint64 occupied = wildcards;
+	uint64 links = 0;
+	for (int type = 0; type < _typeCount; type++)
+	{
+		const uint64 mask = typeMasks[type * lineCount + line];
+		occupied |= mask;
+		links |= mask & (mask >> 1);
+	}
+	links |= (wildcards & (occupied >> 1)) | (occupied & (wildcards >> 1));
+	AppendRunsFromLinks(links, count, runs);
+}
+
+void FPuzzleMatchBitboard::AppendRunsFromLinks(uint64 links, int minCount, TArray<FIntPoint>& runs)
+{
+	//A segment of n links covers n + 1 cells
+	while (links)
+	{
+		const int first = (int)FMath::CountTrailingZeros64(links);
+		const int length = (int)FMath::CountTrailingZeros64(~(links >> first));
+		if (length + 1 >= minCount)
+			runs.Add(FIntPoint(first, first + length));
+		links = (first + length) >= MaxLineLength ? 0 : links & (~0ull << (first + length));
+	}
+}
+
+
+#pragma endregion
@@ -8,13 +8,20 @@
 
 
 void UPuzzleNodeComponent::InitializeNode(UPuzzleLaneComponent* owner_lane, FVector2D node_index)
+{
+	InitializeNode(owner_lane, FIntPoint((int32)node_index.X, (int32)node_index.Y));
+}
+
+void UPuzzleNodeComponent::InitializeNode(UPuzzleLaneComponent* owner_lane, FIntPoint node_cell)
 {
 	_parentLane = owner_lane;
-	GridIndex = node_index;
+	GridCell = node_cell;
+	GridIndex = FVector2D(node_cell.X, node_cell.Y);
 }
 
 void UPuzzleNodeComponent::CLearNode()
 {
+	GridCell = FIntPoint(-1, -1);
 	GridIndex = FVector2D(-1, -1);
 	_parentLane = nullptr;
 }
@@ -35,8 +42,8 @@ void UPuzzleNodeComponent::AttachGem(APuzzleGem* gem, bool fromGrid)
 	if (!_parentLane)
 		return;
 	_currentGem = gem;
-	_currentGem->SetGridIndex(GridIndex);
-	_parentLane->SetGemInGrid(GridIndex.Y, _currentGem);
+	_currentGem->SetGridIndex(GridCell);
+	_parentLane->SetGemInGrid(GridCell.Y, _currentGem);
 	_currentGem->GemState = EGemState::falling;
 	//Set custom gem position depending on RequestGridGemMethod, when gem came from grid
 	if (fromGrid)
@@ -47,6 +54,7 @@ void UPuzzleNodeComponent::AttachGem(APuzzleGem* gem, bool fromGrid)
 	_movementStartLocation = _currentGem->GetActorLocation();
 	_movementAmount = 0;
 	_timeSinceLanding = -99;
+	WakeNode();
 }
 
 APuzzleGem* UPuzzleNodeComponent::DetachGem(bool forced)
@@ -59,10 +67,15 @@ APuzzleGem* UPuzzleNodeComponent::DetachGem(bool forced)
 		CanMoveGem()) && !forced)
 		return nullptr;
 	const auto gem = _currentGem;
-	_parentLane->SetGemInGrid(GridIndex.Y, nullptr);
-	_currentGem->SetGridIndex(FVector2D(-1, -1));
+	_parentLane->SetGemInGrid(GridCell.Y, nullptr);
+	_currentGem->SetGridIndex(FIntPoint(-1, -1));
 	_currentGem->GemState = EGemState::none;
 	_currentGem = nullptr;
+	WakeNode();
+	_parentLane->MarkRefillPending();
+	//The node above may now cascade it's gem
+	if (const auto nodeAbove = _parentLane->GetNodeAtIndex(GridCell.Y + 1))
+		nodeAbove->WakeNode();
 	return gem;
 }
 
@@ -72,9 +85,12 @@ void UPuzzleNodeComponent::RequestGemFromLane(float deltaTime)
 		return;
 	if (_currentGem)
 		return;
+	//The lane refills it's nodes itself
+	if (_parentLane->UsesRefillPlanner())
+		return;
 	bool fromGrid = false;
 	const auto gem = _parentLane->GetGemCascade(
-		(_chronoGridDirectRequest >= DelayGridDirectRequest || IsGemFromGridOnly) ? -2 : GridIndex.Y,
+		(_chronoGridDirectRequest >= DelayGridDirectRequest || IsGemFromGridOnly) ? -2 : GridCell.Y,
 		deltaTime, fromGrid);
 	if (_chronoGridDirectRequest >= DelayGridDirectRequest)
 		_chronoGridDirectRequest = 0;
@@ -89,52 +105,97 @@ void UPuzzleNodeComponent::RequestGemFromLane(float deltaTime)
 	AttachGem(gem, fromGrid);
 }
 
+bool UPuzzleNodeComponent::UpdateGridDirectRequest(float deltaTime)
+{
+	_chronoGridDirectRequest += deltaTime;
+	if (_chronoGridDirectRequest < DelayGridDirectRequest)
+		return false;
+	_chronoGridDirectRequest = 0;
+	return true;
+}
+
 void UPuzzleNodeComponent::MoveGemToNode(float delta)
 {
-	if (!_currentGem)
+	FNodeGemMotion motion;
+	if (!BeginGemMotion(delta, motion))
 		return;
+	EvaluateGemMotion(motion);
+	EndGemMotion(delta, motion);
+}
+
+bool UPuzzleNodeComponent::BeginGemMotion(float delta, FNodeGemMotion& motion)
+{
+	motion = FNodeGemMotion();
+	if (!_currentGem)
+		return false;
 
 	if (!_currentGem->CanMoveGem())
 	{
 		if (_currentGem->GemState == EGemState::falling)
+		{
 			_currentGem->GemState = EGemState::idle;
-		_currentGem->SetActorLocation(GetComponentLocation());
+			MarkCellDirty();
+		}
+		_currentGem->SetActorLocation(GetComponentLocation(), false, nullptr, ETeleportType::TeleportPhysics);
+		return false;
+	}
+
+	motion.Node = this;
+	motion.IsFalling = _currentGem->GemState == EGemState::falling;
+	if (!motion.IsFalling)
+		return true;
+	motion.IsPushed = _externalPushForce.Length() > 0;
+	motion.EasingType = MoveEasingType;
+	motion.StartLocation = _movementStartLocation;
+	motion.TargetLocation = GetComponentLocation() + _externalPushForce;
+	motion.MovementAmount = _movementAmount + delta * _currentGem->GemSpeed * (motion.IsPushed ? 4 : 1);
+	motion.LastEasingValue = _lastMovementEasingValue;
+	return true;
+}
+
+void UPuzzleNodeComponent::EvaluateGemMotion(FNodeGemMotion& motion)
+{
+	if (!motion.IsFalling)
 		return;
+	if (!motion.IsPushed)
+	{
+		motion.EasingValue = MoveByEasing(motion.EasingType, motion.MovementAmount);
+		motion.HasLanded = motion.EasingValue >= 0.95f && motion.LastEasingValue < 0.95f;
 	}
+	else
+	{
+		motion.EasingValue = SineOutEase(motion.MovementAmount);
+		motion.HasLanded = motion.EasingValue > 0 && motion.LastEasingValue <= 0;
+	}
+	motion.Location = motion.MovementAmount >= 1
+		                  ? motion.TargetLocation
+		                  : FMath::Lerp(motion.StartLocation, motion.TargetLocation, motion.EasingValue);
+}
+
+void UPuzzleNodeComponent::EndGemMotion(float delta, const FNodeGemMotion& motion, bool isBatched)
+{
+	if (motion.Node != this || !_currentGem)
+		return;
 
 	//Move
-	if (_currentGem->GemState == EGemState::falling)
+	if (motion.IsFalling && _currentGem->GemState == EGemState::falling)
 	{
-		_movementAmount += delta * _currentGem->GemSpeed * (_externalPushForce.Length() > 0 ? 4 : 1);
-		float movementEasing = _movementAmount;
-		if (_externalPushForce.Length() <= 0)
+		_movementAmount = motion.MovementAmount;
+		if (motion.HasLanded)
 		{
-			movementEasing = MoveByEasing(MoveEasingType, _movementAmount);
-			if (movementEasing >= 0.95f && _lastMovementEasingValue < 0.95f)
-			{
-				_landingForce = _currentGem->GemVelocity * 5 * delta;
-				_timeSinceLanding = _currentGem->LandingDelay;
-			}
+			_landingForce = motion.IsPushed ? _externalPushForce : _currentGem->GemVelocity * 5 * delta;
+			_timeSinceLanding = _currentGem->LandingDelay;
 		}
+		_lastMovementEasingValue = motion.EasingValue;
+		if (isBatched)
+			CommitGemLocation(motion.Location);
 		else
-		{
-			movementEasing = SineOutEase(_movementAmount);
-			if (movementEasing > 0 && _lastMovementEasingValue <= 0)
-			{
-				_landingForce = _externalPushForce;
-				_timeSinceLanding = _currentGem->LandingDelay;
-			}
-		}
-
-		_lastMovementEasingValue = movementEasing;
-		const FVector position = FMath::Lerp(_movementStartLocation
-		                                     , GetComponentLocation() + _externalPushForce, movementEasing);
-		_currentGem->SetActorLocation(position);
+			_currentGem->SetActorLocation(motion.Location, false, nullptr, ETeleportType::TeleportPhysics);
 		if (_movementAmount >= 1)
 		{
 			_movementAmount = 1;
-			_currentGem->SetActorLocation(GetComponentLocation() + _externalPushForce);
 			_currentGem->GemState = EGemState::idle;
+			MarkCellDirty();
 			_lastMovementEasingValue = 0;
 			if (_externalPushForce.Length() > 0)
 				_externalPushForce = FVector::ZeroVector;
@@ -165,6 +226,20 @@ void UPuzzleNodeComponent::MoveGemToNode(float delta)
 	}
 }
 
+void UPuzzleNodeComponent::CommitGemLocation(const FVector& location)
+{
+	const auto root = _currentGem ? _currentGem->GetRootComponent() : nullptr;
+	if (!root)
+		return;
+	//Gems are attached to the grid owner, the location is written in it's space
+	const USceneComponent* parent = root->GetAttachParent();
+	root->SetRelativeLocation_Direct(parent && !root->IsUsingAbsoluteLocation()
+		                                 ? parent->GetSocketTransform(root->GetAttachSocketName()).
+		                                           InverseTransformPosition(location)
+		                                 : location);
+	root->UpdateComponentToWorld(EUpdateTransformFlags::None, ETeleportType::TeleportPhysics);
+}
+
 float UPuzzleNodeComponent::MoveByEasing(TEnumAsByte<EMoveEasingType> type, float inputValue)
 {
 	switch (type)
@@ -195,75 +270,151 @@ void UPuzzleNodeComponent::AddImpulseForceToGem(FVector force)
 		_currentGem->GemState = EGemState::falling;
 		_externalPushForce += force * _currentGem->ExternalForceTransferScale;
 		_movementAmount = 0;
+		WakeNode();
 	}
 }
 
 FVector2D UPuzzleNodeComponent::GetNodeIndexInDirection(FVector direction)
+{
+	const FIntPoint cell = GetNodeCellInDirection(direction);
+	return FVector2D(cell.X, cell.Y);
+}
+
+FIntPoint UPuzzleNodeComponent::GetNodeCellInDirection(FVector direction)
 {
 	FVector dir = direction;
 	if (!dir.Normalize() || !_parentLane || !_parentLane->GetParentGrid())
-		return GridIndex;
-	float Ycompound = GridIndex.Y;
-	float Xcompound = GridIndex.X;
+		return GridCell;
+	int Ycompound = GridCell.Y;
+	int Xcompound = GridCell.X;
+
+	float verticalDot = FVector::DotProduct(dir, _parentLane->GetParentGrid()->GetNodeAxis());
+	float horizontalDot = FVector::DotProduct(dir, _parentLane->GetParentGrid()->GetLaneAxis());
+	Ycompound = verticalDot > 0.5f ? GridCell.Y + 1 : (verticalDot < -0.5f ? GridCell.Y - 1 : Ycompound);
+	Xcompound = horizontalDot > 0.5f ? GridCell.X + 1 : (horizontalDot < -0.5f ? GridCell.X - 1 : Xcompound);
+
+	return FIntPoint(Xcompound, Ycompound);
+}
+
+void UPuzzleNodeComponent::MarkCellDirty()
+{
+	if (_parentLane && _parentLane->GetParentGrid())
+		_parentLane->GetParentGrid()->MarkCellDirty(GridCell);
+}
 
-	float verticalDot = FVector::DotProduct(dir, _parentLane->GetParentGrid()->GetNodeDirection().GetSafeNormal());
-	float horizontalDot = FVector::DotProduct(dir, _parentLane->GetParentGrid()->GetLaneDirection().GetSafeNormal());
-	Ycompound = verticalDot > 0.5f ? GridIndex.Y + 1 : (verticalDot < -0.5f ? GridIndex.Y - 1 : Ycompound);
-	Xcompound = horizontalDot > 0.5f ? GridIndex.X + 1 : (horizontalDot < -0.5f ? GridIndex.X - 1 : Xcompound);
+void UPuzzleNodeComponent::UpdateNode(float delta)
+{
+	RequestGemFromLane(delta);
+	MoveGemToNode(delta);
+	if (CanNodeSleep())
+		SleepNode();
+}
+
+void UPuzzleNodeComponent::SetTickedByGrid(bool tickedByGrid)
+{
+	_isTickedByGrid = tickedByGrid;
+	RefreshNodeTick();
+}
+
+void UPuzzleNodeComponent::WakeNode()
+{
+	if (_isNodeAwake)
+		return;
+	_isNodeAwake = true;
+	if (_parentLane && _parentLane->GetParentGrid())
+		_parentLane->GetParentGrid()->SetNodeActive(GridCell, true);
+	RefreshNodeTick();
+}
 
-	return FVector2D(Xcompound, Ycompound);
+void UPuzzleNodeComponent::SleepNode()
+{
+	if (!_isNodeAwake)
+		return;
+	_isNodeAwake = false;
+	if (_currentGem)
+		_currentGem->GemVelocity = FVector::ZeroVector;
+	if (_parentLane && _parentLane->GetParentGrid())
+		_parentLane->GetParentGrid()->SetNodeActive(GridCell, false);
+	RefreshNodeTick();
+}
+
+bool UPuzzleNodeComponent::CanNodeSleep() const
+{
+	//Vacant nodes keep requesting a gem, unless their lane plans the refills
+	if (!_currentGem)
+		return _parentLane && _parentLane->UsesRefillPlanner();
+	//Swapping gems are moved by the grid, the node keeps syncing them
+	if (_currentGem->GemState == EGemState::falling || _currentGem->GemState == EGemState::swapping)
+		return false;
+	//Landing event pending
+	if ((int)_timeSinceLanding != -99)
+		return false;
+	return (_currentGem->GetActorLocation() - GetComponentLocation()).SquaredLength() <= 1;
+}
+
+void UPuzzleNodeComponent::RefreshNodeTick()
+{
+	SetComponentTickEnabled((!_isTickedByGrid && _isNodeAwake) || GetClass()->IsFunctionImplementedInScript(
+		GET_FUNCTION_NAME_CHECKED(UPuzzleNodeComponent, ReceiveTick)));
 }
 
 FVector UPuzzleNodeComponent::GetCustomGemSpawnLocation(FVector baseLocation)
 {
+	if (_isSpawnLocationStale || _spawnLocationMethod != RequestGridGemMethod)
+		RefreshGemSpawnLocation();
+	return _hasSpawnLocation ? _gemSpawnLocation : baseLocation;
+}
+
+void UPuzzleNodeComponent::RefreshGemSpawnLocation()
+{
+	_isSpawnLocationStale = false;
+	_spawnLocationMethod = RequestGridGemMethod;
+	_hasSpawnLocation = true;
+	//Pop
+	if (RequestGridGemMethod == popAtPosition)
+	{
+		_gemSpawnLocation = GetComponentLocation();
+		return;
+	}
+	const auto grid = _parentLane ? _parentLane->GetParentGrid() : nullptr;
+	if (!grid)
+	{
+		_hasSpawnLocation = false;
+		return;
+	}
 	switch (RequestGridGemMethod)
 	{
 	default:
-		return baseLocation;
+		_hasSpawnLocation = false;
+		return;
 	//normal
 	case fromGridNormal:
-		if (_parentLane && _parentLane->GetParentGrid())
-			return GetComponentLocation() + FVector::CrossProduct(_parentLane->GetParentGrid()->GetNodeDirection(),
-			                                                      _parentLane->GetParentGrid()->GetLaneDirection()).
-				GetSafeNormal() * (_parentLane
-				                   ->GetParentGrid()->GetLaneDirection().Length() + _parentLane->RecyclingZoneDistance);
-		return baseLocation;
+		_gemSpawnLocation = GetComponentLocation() + grid->GetGridNormal() * (grid->GetLaneDirection().Length() +
+			_parentLane->RecyclingZoneDistance);
+		return;
 	//inverse normal
 	case fromGridInverseNormal:
-		if (_parentLane && _parentLane->GetParentGrid())
-			return GetComponentLocation() - FVector::CrossProduct(_parentLane->GetParentGrid()->GetNodeDirection(),
-			                                                      _parentLane->GetParentGrid()->GetLaneDirection()).
-				GetSafeNormal() * (_parentLane
-				                   ->GetParentGrid()->GetLaneDirection().Length() + _parentLane->RecyclingZoneDistance);
-		return baseLocation;
+		_gemSpawnLocation = GetComponentLocation() - grid->GetGridNormal() * (grid->GetLaneDirection().Length() +
+			_parentLane->RecyclingZoneDistance);
+		return;
 	//begin lane
 	case fromBeginOfLane:
-		if (_parentLane && _parentLane->GetParentGrid())
+		if (const auto startNode = grid->GetNodeAt(FIntPoint(GridCell.X, 0)))
 		{
-			auto startNode = _parentLane->GetParentGrid()->GetNodeAt(FVector2D(GridIndex.X, 0));
-			if (startNode)
-			{
-				return startNode->GetComponentLocation() - (_parentLane->GetParentGrid()->GetNodeDirection() *
-					_parentLane->RecyclingZoneDistance);
-			}
-			return baseLocation;
+			_gemSpawnLocation = startNode->GetComponentLocation() - grid->GetNodeDirection() * _parentLane->
+				RecyclingZoneDistance;
+			return;
 		}
-		return baseLocation;
-	//Pop
-	case popAtPosition:
-		return GetComponentLocation();
+		_hasSpawnLocation = false;
+		return;
 	//Last lane
 	case fromLastLaneDirection:
-		if (_parentLane && _parentLane->GetParentGrid())
-			return GetComponentLocation() - (_parentLane->GetParentGrid()->GetLaneDirection() * _parentLane->
-				RecyclingZoneDistance);
-		return baseLocation;
+		_gemSpawnLocation = GetComponentLocation() - grid->GetLaneDirection() * _parentLane->RecyclingZoneDistance;
+		return;
 	//Next lane
 	case fromNextLaneDirection:
-		if (_parentLane && _parentLane->GetParentGrid())
-			return GetComponentLocation() + (_parentLane->GetParentGrid()->GetLaneDirection() * _parentLane->
-				RecyclingZoneDistance);
-		return baseLocation;
+		_gemSpawnLocation = GetComponentLocation() + grid->GetLaneDirection() * _parentLane->RecyclingZoneDistance;
+		return;
 	}
 }
 
@@ -299,12 +450,17 @@ void UPuzzleNodeComponent::TickComponent(float DeltaTime, ELevelTick TickType,
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
 	// ...
+	if (_isTickedByGrid || !_isNodeAwake)
+		return;
+	const auto grid = _parentLane ? _parentLane->GetParentGrid() : nullptr;
+	//The grid fills the nodes itself while initializing
+	if (grid && grid->IsGridInitializing())
+		return;
 	float delta = DeltaTime;
 	//Grid scaled time
-	if (_parentLane && _parentLane->GetParentGrid())
-		delta = _parentLane->GetParentGrid()->GetTimeScale() * DeltaTime;
-	RequestGemFromLane(delta);
-	MoveGemToNode(delta);
+	if (grid)
+		delta = grid->GetTimeScale() * DeltaTime;
+	UpdateNode(delta);
 }
 
 #pragma endregion
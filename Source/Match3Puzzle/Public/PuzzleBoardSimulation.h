@@ -0,0 +1,239 @@
+// Copyright © 2023 by Tyni Boat. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PuzzleEnums.h"
+#include "PuzzleGridMatchArena.h"
+#include "PuzzleMatchBitboard.h"
+
+
+//A cell of a simulated board.
+struct MATCH3PUZZLE_API FPuzzleBoardCell
+{
+public:
+	//The gem type of the cell. EmptyType for no gem, or FPuzzleMatchBitboard::WildcardType for a gem matching every type.
+	int Type = -1;
+
+	//The capabilities of the cell's gem.
+	EGemCapabilities Capabilities = EGemCapabilities::AllCapabilities;
+
+public:
+	//Does the cell hold no gem?
+	FORCEINLINE bool IsEmpty() const { return Type == -1; }
+
+	//Can the cell's gem do all of the capabilities?
+	FORCEINLINE bool Can(EGemCapabilities capabilities) const
+	{
+		return !IsEmpty() && EnumHasAllFlags(Capabilities, capabilities);
+	}
+};
+
+
+//The kind of a simulated board event.
+enum class EPuzzleBoardEventType : uint8
+{
+	//Two gems swapped. From and Cell are the swapped cells.
+	Swap,
+	//A match was found. MatchIndex is it's index in the resolution matches.
+	Match,
+	//A gem was deleted from Cell.
+	Delete,
+	//A gem fell From a cell to Cell, in the same lane.
+	Fall,
+	//A gem of GemType spawned at Cell.
+	Spawn,
+};
+
+
+//An event of a simulated board, in the order it happened.
+struct MATCH3PUZZLE_API FPuzzleBoardEvent
+{
+	//The kind of event.
+	EPuzzleBoardEventType Type = EPuzzleBoardEventType::Match;
+
+	//The cascade step of the event. 0 is the step resolving the swap itself.
+	int Step = 0;
+
+	//The cell the gem came from, for swaps and falls.
+	FIntPoint From = FIntPoint(-1, -1);
+
+	//The cell the event happened at.
+	FIntPoint Cell = FIntPoint(-1, -1);
+
+	//The gem type involved.
+	int GemType = -1;
+
+	//The match index in the resolution matches, for match events.
+	int MatchIndex = INDEX_NONE;
+};
+
+
+//A swap of a simulated board producing a match.
+struct MATCH3PUZZLE_API FPuzzleBoardMove
+{
+	//The swapped cells. CellB is the lane or node neighbour after CellA.
+	FIntPoint CellA = FIntPoint(-1, -1);
+	FIntPoint CellB = FIntPoint(-1, -1);
+
+	//The number of gems matched by the swap, on both cells.
+	int MatchSize = 0;
+};
+
+
+//The ordered outcome of resolving a board to a stable state.
+struct MATCH3PUZZLE_API FPuzzleBoardResolution
+{
+	//Every event, in order.
+	TArray<FPuzzleBoardEvent> Events;
+
+	//Every match found, referenced by match events.
+	FGridMatchArena Matches;
+
+	//The number of cascade steps with a match.
+	int Steps = 0;
+
+	//The number of gems deleted.
+	int DeletedCount = 0;
+
+	//Was the swap kept? false if it produced no match and got swapped back.
+	bool IsSwapAccepted = false;
+
+	//Clear the resolution for reuse, keeping the memory.
+	void Reset()
+	{
+		Events.Reset();
+		Matches.Reset();
+		Steps = 0;
+		DeletedCount = 0;
+		IsSwapAccepted = false;
+	}
+};
+
+
+// Headless simulation of a puzzle board. Holds the gem type of every cell and applies the grid rules (swap, match,
+// delete, gravity toward node 0 and refill) instantly, with no world, actor or component involved.
+struct MATCH3PUZZLE_API FPuzzleBoardSimulation
+{
+public:
+	//The type of an empty cell.
+	static constexpr int EmptyType = -1;
+
+public:
+	//Initialize an empty board. refilled gems get a random type in [0, typeCount), from the seed.
+	void Initialize(int laneCount, int laneLength, int typeCount, int32 seed = 0);
+
+	//Fill every empty cell with a random type, without creating matches when possible.
+	void FillWithoutMatches(int minMatchCount);
+
+	//Get the number of lanes.
+	FORCEINLINE int GetLaneCount() const { return _laneCount; }
+
+	//Get the number of nodes per lane.
+	FORCEINLINE int GetLaneLength() const { return _laneLength; }
+
+	//Get the number of types refilled gems are picked from.
+	FORCEINLINE int GetTypeCount() const { return _typeCount; }
+
+	//Set the number of types refilled gems are picked from.
+	FORCEINLINE void SetTypeCount(int typeCount) { _typeCount = FMath::Max(0, typeCount); }
+
+	//Is a cell inside the board?
+	FORCEINLINE bool IsValidCell(FIntPoint cell) const
+	{
+		return cell.X >= 0 && cell.Y >= 0 && cell.X < _laneCount && cell.Y < _laneLength;
+	}
+
+	//Get a cell of the board. the cell must be valid.
+	FORCEINLINE const FPuzzleBoardCell& GetCell(FIntPoint cell) const { return _cells[cell.X * _laneLength + cell.Y]; }
+
+	//Set a cell of the board. ignored outside the board.
+	FORCEINLINE void SetCell(FIntPoint cell, const FPuzzleBoardCell& value)
+	{
+		if (IsValidCell(cell))
+			_cells[cell.X * _laneLength + cell.Y] = value;
+	}
+
+	//Can two cells be swapped? they must be neighbours holding swappable and movable gems.
+	bool CanSwap(FIntPoint cellA, FIntPoint cellB) const;
+
+	//Swap two cells without any check.
+	void Swap(FIntPoint cellA, FIntPoint cellB);
+
+	//Find every line match of the board. matches are added to the arena, returns true if any was found.
+	bool FindMatches(int minMatchCount, FGridMatchArena& matches);
+
+	//Empty the deletable cells of every match. returns the number of gems deleted. events are recorded in the resolution if any.
+	int ClearMatches(const FGridMatchArena& matches, FPuzzleBoardResolution* resolution = nullptr);
+
+	//Make movable gems fall toward node 0 of their lane. immovable gems stay and hold the gems above. returns the number of gems moved.
+	int ApplyGravity(FPuzzleBoardResolution* resolution = nullptr);
+
+	//Fill every empty cell with a random type. returns the number of gems spawned.
+	int Refill(FPuzzleBoardResolution* resolution = nullptr);
+
+	//Run one cascade step: find matches, delete them, apply gravity and refill. returns false if there was no match.
+	bool Step(int minMatchCount, FPuzzleBoardResolution* resolution = nullptr);
+
+	//Run cascade steps until no match is left, or maxSteps is reached. returns the number of steps with a match.
+	int ResolveToStable(int minMatchCount, int maxSteps = 64, FPuzzleBoardResolution* resolution = nullptr);
+
+	//Swap two cells and resolve the board to a stable state. a swap without match is swapped back, like a user swap on the grid. returns true if the swap was kept.
+	bool ResolveSwap(FIntPoint cellA, FIntPoint cellB, int minMatchCount, FPuzzleBoardResolution& resolution,
+	                 int maxSteps = 64);
+
+	//Get the number of gems matched if two cells were swapped, without swapping them. 0 if the swap matches nothing.
+	int GetSwapMatchSize(FIntPoint cellA, FIntPoint cellB, int minMatchCount) const;
+
+	//Find every swap producing a match. moves are added to the array, returns the number found.
+	int FindValidMoves(int minMatchCount, TArray<FPuzzleBoardMove>& moves) const;
+
+	//Is there any swap producing a match? stops on the first one found.
+	bool HasAnyValidMove(int minMatchCount) const;
+
+	//Get the type a refilled gem gets.
+	FORCEINLINE int RollType() { return _typeCount > 0 ? _random.RandRange(0, _typeCount - 1) : EmptyType; }
+
+private:
+	//Do two cells match together?
+	static bool CellsMatch(const FPuzzleBoardCell& cellA, const FPuzzleBoardCell& cellB);
+
+	//Find the matches of a line of cells, for boards too large for the bitboard.
+	void FindLineMatches(FIntPoint first, FIntPoint step, int length, int minMatchCount, FGridMatchArena& matches) const;
+
+	//Get the number of gems matched on a cell holding a gem, while another cell holds another gem.
+	int GetMatchSizeAt(FIntPoint cell, const FPuzzleBoardCell& value, FIntPoint otherCell,
+	                   const FPuzzleBoardCell& otherValue, int minMatchCount) const;
+
+	//Visit every neighbour pair that can be swapped and would match. stops when the visitor returns false.
+	template <typename VisitorType>
+	void ForEachValidMove(int minMatchCount, VisitorType&& visitor) const;
+
+	//Would a cell complete a line match with the cells below it or before it?
+	bool CompletesMatch(FIntPoint cell, int minMatchCount) const;
+
+private:
+	//The number of lanes.
+	int _laneCount = 0;
+
+	//The number of nodes per lane.
+	int _laneLength = 0;
+
+	//The number of types refilled gems are picked from.
+	int _typeCount = 0;
+
+	//The cells, stored by cell index (lane * lane length + node).
+	TArray<FPuzzleBoardCell> _cells;
+
+	//The random stream of refilled types.
+	FRandomStream _random;
+
+	//The gem type bitboard used to find matches.
+	FPuzzleMatchBitboard _bitboard;
+
+	//The runs buffer used while reading matches from the bitboard.
+	TArray<FIntPoint> _runsBuffer;
+
+	//The matches buffer of the cascade steps.
+	FGridMatchArena _stepMatches;
+};
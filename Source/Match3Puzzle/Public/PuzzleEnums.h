@@ -68,4 +68,38 @@ enum EGridGameplayMode
 	ClickAndDestroy,
 };
 
+//How the gems of a grid are rendered
+UENUM(BlueprintType)
+enum EGemRenderMode
+{
+	GemActors,
+	InstancedGemMeshes,
+};
+
+//When and how a user swap is checked for a match
+UENUM(BlueprintType)
+enum ESwapValidationMode
+{
+	//Play the swap, then swap back if nothing matched
+	ValidateAfterSwap,
+	//Check the swap first, play a short reject animation if it would not match
+	RejectWithAnimation,
+	//Check the swap first, drop it without animation if it would not match
+	RejectOutright,
+};
+
+//The capabilities of a gem, as allowed by it's attachments
+UENUM(BlueprintType, meta = (Bitflags, UseEnumValuesAsMaskValuesInEditor = "true"))
+enum class EGemCapabilities : uint8
+{
+	NoCapability = 0 UMETA(Hidden),
+	CanSelect = 1 << 0,
+	CanSwap = 1 << 1,
+	CanMove = 1 << 2,
+	CanDelete = 1 << 3,
+	CanMatch = 1 << 4,
+	AllCapabilities = CanSelect | CanSwap | CanMove | CanDelete | CanMatch UMETA(Hidden),
+};
+ENUM_CLASS_FLAGS(EGemCapabilities);
+
 #pragma endregion
\ No newline at end of file
@@ -34,10 +34,14 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Gem|Gem Params")
 	float GemDeletionDelay = 0.5f;
 
-	//The gems's grid position.
-	UPROPERTY(BlueprintReadWrite, VisibleAnywhere, Category = "Puzzle Gem|Gem Params")
+	//The gems's grid position. set it with SetGridIndex to keep GridCell in sync.
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere, Category = "Puzzle Gem|Gem Params")
 	FVector2D GridIndex = FVector2D(-1, -1);
 
+	//The gems's grid position as integer cell coordinates. Kept in sync with GridIndex by SetGridIndex.
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere, Category = "Puzzle Gem|Gem Params")
+	FIntPoint GridCell = FIntPoint(-1, -1);
+
 	//The gems's grid position.
 	UPROPERTY(BlueprintReadOnly, VisibleAnywhere, Category = "Puzzle Gem|Gem Params")
 	TEnumAsByte<EGemState> GemState;
@@ -71,6 +75,34 @@ protected:
 	UPROPERTY()
 	TScriptInterface<IPuzzleGemEquatable> _gemEquatable;
 
+	//The type key of the gem's equatable, cached when the equatable is set. -1 if the equatable opted out.
+	UPROPERTY()
+	int _gemTypeKey = INDEX_NONE;
+
+	//The capabilities allowed by every attachment, cached when attachments change.
+	UPROPERTY()
+	EGemCapabilities _gemCapabilities = EGemCapabilities::AllCapabilities;
+
+	//Is the gem updated by it's grid instead of it's own tick?
+	UPROPERTY()
+	bool _isTickedByGrid = false;
+
+	//Is the gem spawned on the grid (not waiting in the recycler bin)?
+	UPROPERTY()
+	bool _isGemInPlay = false;
+
+	//Is the gem drawn as a mesh instance of it's grid instead of by it's own actor?
+	UPROPERTY()
+	bool _isRenderedByGrid = false;
+
+	//The gem's mesh instance in the grid. -1 when the grid doesn't render gems.
+	UPROPERTY()
+	int _gemInstanceIndex = INDEX_NONE;
+
+	//The gem's slot in the grid gem list, used to flag it in the grid sets. -1 when not spawned by a grid.
+	UPROPERTY()
+	int _gemSlot = INDEX_NONE;
+
 #pragma endregion
 
 
@@ -83,11 +115,42 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Gem|Grid Indexing")
 	void SetGridIndex(FVector2D grid_index);
 
+	//Set the gem's grid index (c++)
+	void SetGridIndex(FIntPoint grid_cell);
+
 	//Gem Spawning ################################################################################
 
 	//Called when the gem get spawn on grid
 	void OnGotSpawn_Internal();
 
+	//Is the gem spawned on the grid?
+	FORCEINLINE bool IsGemInPlay() const { return _isGemInPlay; }
+
+
+	//Gem Rendering ################################################################################
+
+	//Let the grid draw the gem as a mesh instance. the actor stays hidden unless the gem carries attachments.
+	void SetRenderedByGrid(bool renderedByGrid, int instanceIndex);
+
+	//Get the gem's mesh instance in the grid. -1 when the grid doesn't render gems.
+	UFUNCTION(BlueprintPure, Category="Puzzle Gem|Rendering")
+	FORCEINLINE int GetGemInstanceIndex() const { return _gemInstanceIndex; }
+
+	//Get the gem's slot in the grid gem list. -1 when not spawned by a grid.
+	FORCEINLINE int GetGemSlot() const { return _gemSlot; }
+
+	//Set the gem's slot in the grid gem list. called by the grid on spawn.
+	FORCEINLINE void SetGemSlot(int gemSlot) { _gemSlot = gemSlot; }
+
+	//Is the gem currently drawn as a mesh instance of it's grid?
+	FORCEINLINE bool ShouldRenderAsInstance() const
+	{
+		return _isRenderedByGrid && _isGemInPlay && _attachmentList.Num() <= 0;
+	}
+
+	//Show the gem actor only when it's in play and not drawn by the grid, and sync the grid instance.
+	void RefreshGemActorVisibility();
+
 	//Called when the gem got spawn on grid
 	UFUNCTION(BlueprintNativeEvent, Category="Puzzle Gem|Life Time")
 	void OnGotSpawn();
@@ -148,6 +211,15 @@ public:
 	//Update gem's velocity
 	void UpdateGemVelocity(float delta);
 
+	//Update the gem attachments and velocity. called by the gem's tick, or by the grid when it batches ticks.
+	void UpdateGem(float delta);
+
+	//Let the grid update the gem instead of it's own tick. the tick stays on for Blueprint tick events.
+	void SetTickedByGrid(bool tickedByGrid);
+
+	//Does the gem need it's own tick function?
+	bool NeedsOwnTick() const;
+
 	//Gem attachments #######################################################################
 
 	//Add an attachment to gem
@@ -176,20 +248,27 @@ public:
 	//Update the list of attachments
 	void HandleAttachments();
 
+	//Recompute the cached capabilities from every attachment. Call it when an attachment's conditions changed.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Gem|Attachment")
+	void RefreshGemCapabilities();
+
 	//Check attachment condition for Selection
-	bool CanSelectGem();
+	FORCEINLINE bool CanSelectGem() const { return EnumHasAnyFlags(_gemCapabilities, EGemCapabilities::CanSelect); }
 
 	//Check attachment condition for Swap
-	bool CanSwapGem();
+	FORCEINLINE bool CanSwapGem() const { return EnumHasAnyFlags(_gemCapabilities, EGemCapabilities::CanSwap); }
 
 	//Check attachment condition for Movement
-	bool CanMoveGem();
+	FORCEINLINE bool CanMoveGem() const { return EnumHasAnyFlags(_gemCapabilities, EGemCapabilities::CanMove); }
 
 	//Check attachment condition for Deletion
-	bool CanDeleteGem();
+	FORCEINLINE bool CanDeleteGem() const { return EnumHasAnyFlags(_gemCapabilities, EGemCapabilities::CanDelete); }
 
 	//Check attachment condition for Matching
-	bool CanMatchGem();
+	FORCEINLINE bool CanMatchGem() const { return EnumHasAnyFlags(_gemCapabilities, EGemCapabilities::CanMatch); }
+
+	//Get every capability allowed by the attachments
+	FORCEINLINE EGemCapabilities GetGemCapabilities() const { return _gemCapabilities; }
 
 	
 
@@ -207,6 +286,10 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Gem|Grid Matching")
 	bool CompareGemTo(APuzzleGem* other);
 
+	//Get the cached type key of the gem's equatable. -1 if the gem has no equatable or it's equatable has no type key.
+	UFUNCTION(BlueprintPure, Category="Puzzle Gem|Grid Matching")
+	FORCEINLINE int GetGemTypeKey() const { return _gemTypeKey; }
+
 	
 	//Called when the gem's Equatable got changed.
 	UFUNCTION(BlueprintNativeEvent)
@@ -29,6 +29,13 @@ public:
 	bool GemEquals(const TScriptInterface<IPuzzleGemEquatable>& other);
 
 	
+	//Get a stable integer key of this equatable's gem type. equatables with the same key match. return -1 to opt out and be compared with GemEquals.
+	UFUNCTION(BlueprintNativeEvent)
+	int GetGemTypeKey();
+
 	//Compare this gem equatable to another one. return true if they match. c++
 	virtual bool GemEquals_Implementation(const TScriptInterface<IPuzzleGemEquatable>& other);
+
+	//Get a stable integer key of this equatable's gem type. return -1 to opt out and be compared with GemEquals. c++
+	virtual int GetGemTypeKey_Implementation();
 };
@@ -8,9 +8,14 @@
 #include "Components/SceneComponent.h"
 #include "PuzzleStructs.h"
 #include "PuzzleLaneComponent.h"
+#include "PuzzleMatchBitboard.h"
+#include "PuzzleGridMatchArena.h"
+#include "PuzzleBoardSimulation.h"
 #include "PuzzleGridComponent.generated.h"
 
 
+class UInstancedStaticMeshComponent;
+
 // The Match3PuzzleGrid component
 UCLASS(ClassGroup = (Match3Puzzle), BlueprintType, Blueprintable, Abstract
 	, hidecategories = (Object, LOD, Lighting, TextureStreaming, Velocity, PlanarMovement, MovementComponent, Tags,
@@ -46,6 +51,14 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params")
 	bool AutoInitGrid = true;
 
+	//Initialize the grid on begin Play over several frames, instead of in one frame.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params")
+	bool AsyncGridInit = false;
+
+	//The time spent creating lanes and gems per frame during an async init, in milliseconds.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params", meta=(ClampMin = 0))
+	float InitFrameBudget = 2;
+
 	//The grid size. x define the number of lanes and y the lane's length
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params")
 	FVector2D GridSize;
@@ -66,6 +79,30 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params")
 	int MinMatchCount = 3;
 
+	//When and how user swaps are checked for a match.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params")
+	TEnumAsByte<ESwapValidationMode> SwapValidationMode = ValidateAfterSwap;
+
+	//How far toward each other the gems of a rejected swap move before going back, in node size ratio.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params", meta=(ClampMin = 0, ClampMax = 1))
+	float RejectSwapAmplitude = 0.25;
+
+	//Update every node and gem from the grid tick instead of their own tick functions. Applied on grid init.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params")
+	bool BatchGridTick = true;
+
+	//Let each lane plan the drop and spawn of all it's gems at once when a node gets empty, instead of nodes polling for a gem. Applied on grid init.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params")
+	bool PlanLaneRefills = true;
+
+	//The delay between two retries of the lane refills the recycler could not serve, in seconds. the spawn condition may change without any gem getting deleted.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params", meta=(ClampMin = 0))
+	float RefillRetryDelay = 0.25;
+
+	//The number of moving gems from which the batched tick evaluates their motion on worker threads.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Grid Params", meta=(ClampMin = 1))
+	int ParallelMotionMinCount = 32;
+
 
 	//Grid Behaviours #############################################################################################
 
@@ -74,6 +111,22 @@ public:
 	TEnumAsByte<EGridFillingStrategy> FillingStrategy;
 
 
+	//Rendering #############################################################################################
+
+	//How the gems are rendered. instanced meshes draw every gem in one component, only gems carrying attachments show their actor. Applied on grid init.
+	//Gem actors are still spawned for every cell, instancing only saves their rendering. instanced gems tell their type by the equatable type key, equatables without key all render as -1.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Rendering")
+	TEnumAsByte<EGemRenderMode> GemRenderMode = GemActors;
+
+	//The mesh of instanced gems. the gem type key is passed to the material as per-instance custom data 0.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Rendering")
+	UStaticMesh* InstancedGemMesh;
+
+	//The material override of instanced gems.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Rendering")
+	UMaterialInterface* InstancedGemMaterial;
+
+
 	//Inputs #############################################################################################
 
 	//The Default trace channel
@@ -84,6 +137,10 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Inputs")
 	float InputTraceDistance;
 
+	//Enable the collision of gems, for trace inputs. disable it when inputs pick cells with GetCellFromRay or GetCellFromScreen.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Grid|Inputs")
+	bool GemCollisionEnabled = true;
+
 #pragma endregion
 
 #pragma region Caches
@@ -97,9 +154,21 @@ protected:
 	UPROPERTY()
 	TArray<APuzzleGem*> _gemsAll;
 
-	// The map of gem present in grid.
+	// The gems present in grid, stored row-major by cell index (lane * lane length + node).
+	UPROPERTY()
+	TArray<APuzzleGem*> _gemsInGrid;
+
+	// The nodes of the grid, stored row-major by cell index (lane * lane length + node).
 	UPROPERTY()
-	TMap<FVector2D, APuzzleGem*> _gemsInGrid;
+	TArray<UPuzzleNodeComponent*> _nodesInGrid;
+
+	// The number of lanes the grid was initialized with.
+	UPROPERTY()
+	int _laneCount;
+
+	// The number of nodes per lane the grid was initialized with.
+	UPROPERTY()
+	int _laneLength;
 
 	// The array of gems waiting to be destroyed
 	UPROPERTY()
@@ -109,6 +178,12 @@ protected:
 	UPROPERTY()
 	TArray<APuzzleGem*> _gemsRecyclerBin;
 
+	// The gem slots waiting to be destroyed, for constant time lookups.
+	TBitArray<> _pendingDeletionSlots;
+
+	// The gem slots in the recycler bin, for constant time lookups.
+	TBitArray<> _recycledSlots;
+
 	//The last selected gem.
 	UPROPERTY()
 	APuzzleGem* _lastSelectedGem;
@@ -121,6 +196,42 @@ protected:
 	UPROPERTY()
 	float _nodeDistance;
 
+	//The node direction with node distance, cached from the grid rotation.
+	UPROPERTY()
+	FVector _nodeDirection;
+
+	//The lane direction with lane distance, cached from the grid rotation.
+	UPROPERTY()
+	FVector _laneDirection;
+
+	//The unit node direction.
+	UPROPERTY()
+	FVector _nodeAxis;
+
+	//The unit lane direction.
+	UPROPERTY()
+	FVector _laneAxis;
+
+	//The unit normal of the grid plane, from the node and lane directions.
+	UPROPERTY()
+	FVector _gridNormal;
+
+	//Is the grid being initialized over several frames?
+	UPROPERTY()
+	bool _isGridInitializing = false;
+
+	//The lane class of the init in progress.
+	UPROPERTY()
+	TSubclassOf<UPuzzleLaneComponent> _initLaneClass;
+
+	//The number of lanes created by the init in progress.
+	UPROPERTY()
+	int _initLaneCount = 0;
+
+	//The number of gems spawned by the init in progress.
+	UPROPERTY()
+	int _initGemCount = 0;
+
 	//The actual time scale of the grid
 	UPROPERTY()
 	float _gridTimeScale = 1;
@@ -131,23 +242,144 @@ protected:
 
 	//The position to consider while match making, no matter their gem's state
 	UPROPERTY()
-	TArray<FVector2D> _swapGridPositionExceptions;
+	TArray<FIntPoint> _swapGridPositionExceptions;
+
+	//The match arena for all the grid, reused every match scan.
+	FGridMatchArena _matchArena;
 
-	//The match array for all the grid.
+	//The match arena used by Blueprint match functions, to keep the grid arena untouched.
+	FGridMatchArena _scratchMatchArena;
+
+	//The match positions of the swaps ended on this tick.
 	UPROPERTY()
-	TArray<FGridMatch> _allGridMatches;
+	TArray<FIntPoint> _swapMatchPositionsBuffer;
 	
 	//Multi-purpose position buffer. Use only sequentially to avoid errors
 	UPROPERTY()
-	TArray<FVector2D> _multiPurposePositionBuffer_1;
+	TArray<FIntPoint> _multiPurposePositionBuffer_1;
 	
 	//Multi-purpose position buffer. Use only sequentially to avoid errors
 	UPROPERTY()
-	TArray<FVector2D> _multiPurposePositionBuffer_2;
+	TArray<FIntPoint> _multiPurposePositionBuffer_2;
 	
-	//The history of swapped gems positions.
+	//The swap sequence number of every cell, 0 if the cell's gem is not in the swap history. earlier swaps have lower numbers.
+	UPROPERTY()
+	TArray<int> _swapSequences;
+
+	//The sequence number given to the next swapped cell.
+	UPROPERTY()
+	int _nextSwapSequence = 1;
+
+	//The number of cells in the swap history.
+	UPROPERTY()
+	int _swapHistoryCount = 0;
+
+	//The gem type bitboard used to find matches on the grid.
+	FPuzzleMatchBitboard _matchBitboard;
+
+	//One gem per distinct type found while filling the bitboard. the index is the type slot.
 	UPROPERTY()
-	TArray<FVector2D> _swapHistory;
+	TArray<APuzzleGem*> _gemTypeRepresentatives;
+
+	//The type key of every type slot representative. -1 while no keyed gem equals a representative without type key.
+	UPROPERTY()
+	TArray<int> _gemTypeRepresentativeKeys;
+
+	//The runs buffer used while reading matches from the bitboard.
+	UPROPERTY()
+	TArray<FIntPoint> _bitboardRunsBuffer;
+
+	//The union-find parent of every match while compacting intersections.
+	UPROPERTY()
+	TArray<int> _matchUnionParents;
+
+	//The next match of the same union while compacting intersections, in descending match order.
+	UPROPERTY()
+	TArray<int> _matchUnionNext;
+
+	//The intersection cell kept for every union root while compacting intersections.
+	UPROPERTY()
+	TArray<FIntPoint> _matchUnionIntersections;
+
+	//The first match owning each cell while compacting intersections.
+	UPROPERTY()
+	TArray<int> _cellMatchOwners;
+
+	//The last match of every union while compacting intersections.
+	UPROPERTY()
+	TArray<int> _matchUnionHeads;
+
+	//The match spans compacted matches are written to.
+	TArray<FGridMatchArena::FSpan> _compactedSpansBuffer;
+
+	//The nodes currently awake, by cell index. only those are updated by the batched tick.
+	TBitArray<> _activeNodes;
+
+	//The gem motions of the awake nodes, packed for the batched tick.
+	TArray<FNodeGemMotion> _gemMotions;
+
+	//The mesh instances drawing the gems, when the grid renders gems. instance n is the gem n of the gems array.
+	UPROPERTY()
+	UInstancedStaticMeshComponent* _gemInstances;
+
+	//Did a gem instance change since the last render state update?
+	UPROPERTY()
+	bool _areGemInstancesDirty;
+
+	//Was a gem without type key rendered as an instance since the grid init?
+	UPROPERTY()
+	bool _hasWarnedUnkeyedInstance;
+
+	//The headless simulation mirroring the grid, captured on demand.
+	FPuzzleBoardSimulation _simulation;
+
+	//The cells in range of the current radial force.
+	TArray<int> _radialForceCells;
+
+	//The node offsets from the center of the current radial force, then the forces to apply.
+	TArray<FVector> _radialForceOffsets;
+
+	//The cells locked by an active swap.
+	TBitArray<> _swapLockedCells;
+
+	//The lanes waiting for a refill.
+	TBitArray<> _pendingRefillLanes;
+
+	//The lanes the recycler could not refill, waiting for it to change.
+	TBitArray<> _parkedRefillLanes;
+
+	//Did the recycler run out or refuse a gem since it last changed?
+	bool _isRecyclerStarved = false;
+
+	//The time since the parked lanes were last retried.
+	float _refillRetryChrono = 0;
+
+	//The gems of the current refill batch.
+	UPROPERTY()
+	TArray<APuzzleGem*> _refillBatchBuffer;
+
+	//Did a cell change since the simulation was captured?
+	UPROPERTY()
+	bool _isSimulationStale = true;
+
+	//The board swaps are simulated on, copied from the simulation.
+	FPuzzleBoardSimulation _scratchSimulation;
+
+	//The resolution of Blueprint simulated swaps.
+	FPuzzleBoardResolution _scratchResolution;
+
+	//The moves buffer of move queries.
+	TArray<FPuzzleBoardMove> _validMovesBuffer;
+
+	//The lanes with a changed cell since the last match scan.
+	TBitArray<> _dirtyLanes;
+
+	//The rows with a changed cell since the last match scan.
+	TBitArray<> _dirtyRows;
+
+	//Is there any changed cell since the last match scan?
+	UPROPERTY()
+	bool _isGridDirty;
 	
 
 #pragma endregion
@@ -159,10 +391,44 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Life Time")
 	void InitializeGrid(FVector2D grid_size, FVector2D node_size, TSubclassOf<UPuzzleLaneComponent> lane_class);
 
+	//Initialize the grid over several frames, within the init frame budget. OnGridInit is called once done.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Life Time")
+	void InitializeGridAsync(FVector2D grid_size, FVector2D node_size, TSubclassOf<UPuzzleLaneComponent> lane_class);
+
+	//Is the grid still being initialized?
+	UFUNCTION(BlueprintPure, Category="Puzzle Grid|Life Time")
+	FORCEINLINE bool IsGridInitializing() const { return _isGridInitializing; }
+
 	//Reset the grid delting All Lanes and gems
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Life Time")
 	void ClearGrid();
 
+	//Clear the grid and prepare it's storage for a new size. lanes and gems are created by StepGridInit.
+	void BeginGridInit(FVector2D grid_size, FVector2D node_size, TSubclassOf<UPuzzleLaneComponent> lane_class);
+
+	//Create lanes, then gems, until the budget is spent. a negative budget creates everything. returns true once done.
+	bool StepGridInit(double budgetSeconds);
+
+	//Size the cell storage and cell sets for a grid size. cells are empty.
+	void ResizeGridStorage(FVector2D grid_size);
+
+	//Create a lane and it's nodes.
+	void CreateLaneAt(int lane_index);
+
+	//Get the location of a lane, centered on the grid.
+	FVector GetLaneLocation(int lane_index) const;
+
+	//Get the node pop method of a lane from the grid filling strategy.
+	EGridGemNodePopMethod GetLanePopMethod(int lane_index, bool& forall);
+
+	//Resize the grid, keeping the existing lanes, nodes and gems. only the difference is created or deleted, every gem
+	//goes back to the recycler bin and the grid refills. OnGridInit is called once done.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Life Time")
+	void ResizeGrid(FVector2D grid_size, FVector2D node_size);
+
+	//Spawn a gem in the recycler bin.
+	void SpawnGridGem(int gem_index);
+
 	//Event when the grid just got Init.
 	UFUNCTION(BlueprintNativeEvent)
 	void OnGridInit();
@@ -184,6 +450,27 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Life Time")
 	void SetTimeScale(float timeScale);
 
+	//Update every awake node and it's gem in one pass, when the grid batches their ticks.
+	void UpdateGridElements(float delta);
+
+	//Set a node as awake or asleep in the active set. called by the node itself.
+	void SetNodeActive(FIntPoint grid_cell, bool active);
+
+	//Wake the node at a grid cell, so it gets updated again.
+	void WakeNodeAt(FIntPoint grid_cell);
+
+	//Queue a lane with empty nodes for the next refill batch. called by the lane itself.
+	void QueueLaneRefill(int lane_index);
+
+	//Park a lane the recycler could not refill, until the recycler or the spawn condition changes.
+	void ParkLaneRefill(int lane_index);
+
+	//Retry the parked lanes once the retry delay is over.
+	void RetryParkedRefills(float delta);
+
+	//Refill every queued lane: drop their gems, then get one batch of recycled gems for all their empty nodes.
+	void HandleRefillQueue(float delta);
+
 	
 #pragma endregion
 
@@ -200,7 +487,26 @@ public:
 	virtual FGemSwapHandler HandleInputs_Implementation();
 
 	//Handle swaps on the grid and update their states. returns match positions.
-	void HandleSwapsOnGrid(FGemSwapHandler newSwap, TArray<FVector2D>& swapMatchPositions, float delta);
+	void HandleSwapsOnGrid(const FGemSwapHandler& newSwap, TArray<FIntPoint>& swapMatchPositions, float delta);
+
+	//Lock the cells of a swap and add it to the active swaps, with it's nodes. returns false if a cell is already swapping.
+	bool AdmitSwap(const FGemSwapHandler& newSwap, bool isRejected = false);
+
+	//Remove an active swap and unlock it's cells.
+	void RemoveActiveSwap(int index);
+
+	//Is a cell locked by an active swap?
+	FORCEINLINE bool IsCellSwapping(FIntPoint grid_cell) const
+	{
+		const int cellIndex = GetCellIndex(grid_cell);
+		return cellIndex != INDEX_NONE && _swapLockedCells.IsValidIndex(cellIndex) && _swapLockedCells[cellIndex];
+	}
+
+	//Would a new user swap be rejected by the swap validation mode? checked against the board model, before any animation. only neighbour swaps are pre-validated.
+	bool ShouldRejectSwap(const FGemSwapHandler& newSwap);
+
+	//Play the reject animation of a swap, with the gems still on their nodes. returns true once finished.
+	bool HandleRejectedSwap(FGemSwapHandler& swap, UPuzzleNodeComponent* nodeA, UPuzzleNodeComponent* nodeB, float delta);
 
 	//Add force to all nodes on the grid
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Inputs")
@@ -220,14 +526,29 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Query")
 	APuzzleGem* GetGemAt(FVector2D grid_index);
 
+	//Get a gem on the grid by it's grid cell (c++)
+	APuzzleGem* GetGemAt(FIntPoint grid_cell);
+
 	//Set a gem on the grid at an grid index.
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Query")
 	void SetGemAt(FVector2D grid_index, APuzzleGem* gem);
 
+	//Set a gem on the grid at a grid cell (c++)
+	void SetGemAt(FIntPoint grid_cell, APuzzleGem* gem);
+
 	//Retrieve a gem from the recycler bin
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Query")
 	APuzzleGem* GetRecycledGem(float deltaTime);
 
+	//Is a gem of this grid flagged in a gem slot set? gems from elsewhere are looked up in the fallback array.
+	bool IsGemInSlotSet(const APuzzleGem* gem, const TBitArray<>& slots, const TArray<APuzzleGem*>& fallback) const;
+
+	//Flag a gem of this grid in a gem slot set.
+	void SetGemInSlotSet(const APuzzleGem* gem, TBitArray<>& slots, bool value);
+
+	//Get up to count recycled gems at once. stops on the first gem the spawn condition refuses. returns the number added.
+	int GetRecycledGems(int count, float deltaTime, TArray<APuzzleGem*>& gems);
+
 	//Handle the update for gem thet need to be deleted.
 	void HandleGemToDelete(float delta);
 
@@ -262,6 +583,10 @@ public:
 	//Override this event to customize the condition to spawn a new gem into the grid
 	UFUNCTION(BlueprintNativeEvent)
 	bool SpawnGemCondition(APuzzleGem* gemRequested);
+
+	//Retry the refills of the lanes waiting for a gem. call it when the spawn condition may have changed.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Life Time")
+	void RequeueLaneRefills();
 	
 	//Override this event to customize the condition to spawn a new gem into the grid
 	virtual  bool SpawnGemCondition_Implementation(APuzzleGem* gemRequested);
@@ -276,6 +601,44 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Query")
 	UPuzzleNodeComponent* GetNodeAt(FVector2D grid_index);
 
+	//Get a node on the grid by it's grid cell (c++)
+	UPuzzleNodeComponent* GetNodeAt(FIntPoint grid_cell);
+
+	//Get the flat cell index (lane * lane length + node) of a grid index. returns INDEX_NONE if outside the grid.
+	FORCEINLINE int GetCellIndex(int lane, int node) const
+	{
+		if (lane < 0 || node < 0 || lane >= _laneCount || node >= _laneLength)
+			return INDEX_NONE;
+		return lane * _laneLength + node;
+	}
+
+	//Get the flat cell index (lane * lane length + node) of a grid index. returns INDEX_NONE if outside the grid.
+	FORCEINLINE int GetCellIndex(FVector2D grid_index) const
+	{
+		return GetCellIndex((int)grid_index.X, (int)grid_index.Y);
+	}
+
+	//Get the flat cell index (lane * lane length + node) of a grid cell. returns INDEX_NONE if outside the grid.
+	FORCEINLINE int GetCellIndex(FIntPoint grid_cell) const
+	{
+		return GetCellIndex(grid_cell.X, grid_cell.Y);
+	}
+
+#pragma endregion
+
+#pragma region Rendering functions
+
+public:
+	//Copy a gem's transform and type key to it's mesh instance. the instance is collapsed when the gem actor is shown.
+	void SyncGemInstance(APuzzleGem* gem);
+
+	//Sync the mesh instances of the gems on awake nodes, and push the changes to the renderer.
+	void SyncActiveGemInstances();
+
+	//Get the gem drawn by a mesh instance, as given by a trace hit item.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Query")
+	APuzzleGem* GetGemFromInstance(int instanceIndex);
+
 #pragma endregion
 
 #pragma region Spatial functions
@@ -289,6 +652,36 @@ public:
 	UFUNCTION(BlueprintGetter, Category="Puzzle Grid|Query")
 	FVector GetLaneDirection() const;
 
+	//Get the unit direction in which nodes where spawn.
+	FORCEINLINE const FVector& GetNodeAxis() const { return _nodeAxis; }
+
+	//Get the unit direction in which lanes where spawn.
+	FORCEINLINE const FVector& GetLaneAxis() const { return _laneAxis; }
+
+	//Get the unit normal of the grid plane.
+	FORCEINLINE const FVector& GetGridNormal() const { return _gridNormal; }
+
+	//Get the cell under a world location, projected on the grid plane. returns false if outside the grid.
+	bool GetCellAtLocation(FVector location, FIntPoint& cell) const;
+
+	//Get the cell hit by a ray on the grid plane, without any trace. returns false if the ray misses the grid.
+	bool GetCellFromRay(FVector origin, FVector direction, FIntPoint& cell) const;
+
+	//Get the cell hit by a ray on the grid plane, without any trace. returns false if the ray misses the grid.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Inputs")
+	bool GetCellFromRay(FVector origin, FVector direction, FVector2D& cell) const;
+
+	//Get the cell under a screen position of a player, without any trace. returns false if it misses the grid.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Inputs")
+	bool GetCellFromScreen(APlayerController* player, FVector2D screenPosition, FVector2D& cell) const;
+
+	//Get the gem hit by a ray on the grid plane, without any trace. null if there is none.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Inputs")
+	APuzzleGem* GetGemFromRay(FVector origin, FVector direction);
+
+	//Cache the grid basis from the grid rotation and node size, and let the nodes recompute their spawn locations.
+	void RefreshGridBasis();
+
 #pragma endregion
 
 	
@@ -300,21 +693,45 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Match Making")
 	bool CheckMatchAroundPosition(FVector2D position, TArray<FVector2D>& matchPositions);
 
+	//Check for a match around a grid cell. returns true if a match was found with cells of that match. (c++)
+	bool CheckMatchAroundPosition(FIntPoint position, TArray<FIntPoint>& matchPositions);
+
 	//Check matches in an aligned line. provide a temps position buffer to avoid GC and a Min Match Count for the minimum of gem aligned for a match to be valid.
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Match Making")
-	bool CheckMatchesInLine(TArray<FVector2D> positions,TArray<FVector2D>& tempPositionBuffer, TArray<FGridMatch>& resultingMatches, int minPositionsCountForMatch = 3);
+	bool CheckMatchesInLine(const TArray<FVector2D>& positions,TArray<FVector2D>& tempPositionBuffer, TArray<FGridMatch>& resultingMatches, int minPositionsCountForMatch = 3);
+
+	//Check matches in an aligned line of grid cells. matches are added to the arena. (c++)
+	bool CheckMatchesInLine(TArrayView<const FIntPoint> positions, FGridMatchArena& resultingMatches, int minPositionsCountForMatch = 3);
+
+	//Find every line match of the grid using the gem type bitboard. returns false if the grid can't fit in a bitboard.
+	bool FindGridMatchesWithBitboard(FGridMatchArena& resultingMatches);
+
+	//Close the match being built in an arena, moving it's earliest swapped cell to the end.
+	void EndSwapOrderedMatch(FGridMatchArena& resultingMatches);
+
+	//Get the bitboard type slot of a gem, registering a new type if needed.
+	int GetGemTypeSlot(APuzzleGem* gem);
 
 	//Compact horizontal and vertical matches into contigue matches
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Match Making")
 	void CompactMatchesOnIntersections(TArray<FGridMatch>& resultingMatches);
 
+	//Compact horizontal and vertical matches of an arena into contigue matches (c++)
+	void CompactMatchesOnIntersections(FGridMatchArena& resultingMatches);
+
+	//Get the swap priority of a cell. lower is the earliest swapped, MAX_int32 if the cell is not in the swap history.
+	int GetSwapPriority(FIntPoint cell) const;
+
 	//Merge two matches and return the result with intersection position at the end of the match. true if Merging happens and false if not
 	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Match Making")
 	bool MergeMatches(FGridMatch& match_A, FGridMatch& match_B, FGridMatch& result);
 
 	//Check if a match can be destroyed.
 	UFUNCTION(BlueprintCallable,  Category="Puzzle Grid|Match Making")
-	bool CanDestroyMatch(FGridMatch& match, TArray<FVector2D> exceptionList);
+	bool CanDestroyMatch(const FGridMatch& match, const TArray<FVector2D>& exceptionList);
+
+	//Check if a match can be destroyed. (c++)
+	bool CanDestroyMatch(TArrayView<const FIntPoint> match, TArrayView<const FIntPoint> exceptionList);
 	
 	//Called when a gem swap finnished. return true if the swap ended with a match.
 	UFUNCTION(BlueprintNativeEvent, Category="Puzzle Grid|Match Making")
@@ -324,10 +741,49 @@ public:
 	virtual void OnSwapEnded_Implementation(bool swapResult,FVector2D fromPosition, FVector2D toPosition);
 
 	//Handle priorityMatches on the grid. responsible of gem destruction and transformation (LV up) if applicable.
-	void HandleGridMatches(TArray<FVector2D>& exceptionPositions);
+	void HandleGridMatches(TArray<FIntPoint>& exceptionPositions);
 
 	//Update the gem swap history
-	void UpdateSwapHistory(FVector2D gemPosition, bool removeOperation = false);
+	void UpdateSwapHistory(FIntPoint gemPosition, bool removeOperation = false);
+
+	//Mark a cell as changed (gem landed, swapped, spawned, removed or changed equatable), so it's lane and row get rescanned for matches.
+	void MarkCellDirty(FIntPoint grid_cell);
+
+	//Mark the whole grid to be rescanned for matches. Use it when a custom logic changes how gems match.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Match Making")
+	void MarkGridDirty();
+
+#pragma endregion
+
+
+#pragma region Simulation Functions
+
+public:
+	//Copy the grid into a headless board: gem types, capabilities and empty cells. gems pending deletion are empty.
+	void CaptureSimulation(FPuzzleBoardSimulation& board);
+
+	//Get the headless board mirroring the grid, captured again if a cell changed.
+	const FPuzzleBoardSimulation& GetSimulation();
+
+	//Resolve a swap on a copy of the grid, instantly and with no animation. the resolution gets every match, delete,
+	//fall and spawn event in order. the stable board is copied to resultBoard if any. returns true if the swap would be kept.
+	bool SimulateSwap(FIntPoint cellA, FIntPoint cellB, FPuzzleBoardResolution& resolution,
+	                  FPuzzleBoardSimulation* resultBoard = nullptr);
+
+	//Resolve a swap on a copy of the grid, instantly and with no animation. returns true if the swap would be kept.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Simulation")
+	bool SimulateSwap(FVector2D cellA, FVector2D cellB, int& cascadeSteps, int& deletedGems);
+
+	//Find every swap of the grid producing a match. returns the number found.
+	int FindValidMoves(TArray<FPuzzleBoardMove>& moves);
+
+	//Is there any swap of the grid producing a match? false means the board is dead and needs a reshuffle.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Simulation")
+	bool HasAnyValidMove();
+
+	//Get the swap of the grid matching the most gems, for hints. returns false if there is none.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Grid|Simulation")
+	bool GetBestMove(FVector2D& cellA, FVector2D& cellB, int& matchSize);
 	
 #pragma endregion
 	
@@ -342,6 +798,9 @@ protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
 
+	// Called when the grid transform changed
+	virtual void OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport) override;
+
 public:
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType,
@@ -0,0 +1,108 @@
+// Copyright © 2023 by Tyni Boat. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PuzzleStructs.h"
+
+
+// Frame arena of grid matches. The cells of every match are stored back to back in one array and a match is a span
+// of it, so a match scan reuses the same memory every tick instead of allocating an array per match.
+struct MATCH3PUZZLE_API FGridMatchArena
+{
+public:
+	//A match of the arena, as a span of the arena cells.
+	struct FSpan
+	{
+		int First = 0;
+		int Num = 0;
+	};
+
+public:
+	//Remove every match, keeping the memory for the next scan.
+	FORCEINLINE void Reset()
+	{
+		_cells.Reset();
+		_spans.Reset();
+	}
+
+	//Get the number of matches.
+	FORCEINLINE int Num() const { return _spans.Num(); }
+
+	//Get the number of cells stored in the arena, including the ones of matches dropped by SwapSpans.
+	FORCEINLINE int NumCells() const { return _cells.Num(); }
+
+	//Get the cells of a match.
+	FORCEINLINE TArrayView<const FIntPoint> GetMatch(int index) const
+	{
+		const FSpan& span = _spans[index];
+		return TArrayView<const FIntPoint>(_cells.GetData() + span.First, span.Num);
+	}
+
+	//Get the cells of a match, for reordering.
+	FORCEINLINE TArrayView<FIntPoint> GetMatchMutable(int index)
+	{
+		const FSpan& span = _spans[index];
+		return TArrayView<FIntPoint>(_cells.GetData() + span.First, span.Num);
+	}
+
+	//Get a cell of the arena. unlike match views, stays valid while the arena grows.
+	FORCEINLINE FIntPoint GetCell(int cellIndex) const { return _cells[cellIndex]; }
+
+	//Get the span of a match.
+	FORCEINLINE const FSpan& GetSpan(int index) const { return _spans[index]; }
+
+	//Start a new match. cells added until EndMatch belong to it. AddCell can also be used alone to build spans for SwapSpans.
+	FORCEINLINE void BeginMatch() { _openMatchFirst = _cells.Num(); }
+
+	//Add a cell to the match being built.
+	FORCEINLINE void AddCell(FIntPoint cell) { _cells.Add(cell); }
+
+	//Close the match being built. returns it's index, or INDEX_NONE if it has no cell.
+	FORCEINLINE int EndMatch()
+	{
+		const int count = _cells.Num() - _openMatchFirst;
+		if (count <= 0)
+			return INDEX_NONE;
+		return _spans.Add({_openMatchFirst, count});
+	}
+
+	//Replace the matches by a new list of spans over the same cells. the spans buffer is swapped, not copied.
+	FORCEINLINE void SwapSpans(TArray<FSpan>& spans) { Swap(_spans, spans); }
+
+	//Copy every match to Blueprint grid matches.
+	void ToGridMatches(TArray<FGridMatch>& matches) const
+	{
+		matches.SetNum(_spans.Num());
+		for (int i = 0; i < _spans.Num(); i++)
+		{
+			const auto match = GetMatch(i);
+			matches[i].MatchPositions.Reset(match.Num());
+			for (const auto cell : match)
+				matches[i].MatchPositions.Add(FVector2D(cell.X, cell.Y));
+		}
+	}
+
+	//Replace every match by Blueprint grid matches, skipping the empty ones.
+	void FromGridMatches(const TArray<FGridMatch>& matches)
+	{
+		Reset();
+		for (const FGridMatch& match : matches)
+		{
+			BeginMatch();
+			for (const auto pos : match.MatchPositions)
+				_cells.Add(FIntPoint((int32)pos.X, (int32)pos.Y));
+			EndMatch();
+		}
+	}
+
+private:
+	//The cells of every match, back to back.
+	TArray<FIntPoint> _cells;
+
+	//The span of every match.
+	TArray<FSpan> _spans;
+
+	//The first cell of the match being built.
+	int _openMatchFirst = 0;
+};
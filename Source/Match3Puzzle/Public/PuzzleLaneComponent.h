@@ -58,6 +58,25 @@ protected:
 	UPROPERTY()
 	FVector _directionToRecycler;
 
+	// Is the lane updated by the grid instead of it's own tick?
+	UPROPERTY()
+	bool _isTickedByGrid = false;
+
+	// Does the lane plan it's refills instead of letting it's nodes poll for a gem?
+	UPROPERTY()
+	bool _usesRefillPlanner = false;
+
+	// Did a node of the lane get empty since the last refill plan?
+	UPROPERTY()
+	bool _isRefillPending = false;
+
+	// The number of gems spawned since the last drop, to stack them above the recycler.
+	UPROPERTY()
+	int _spawnedSinceDrop = 0;
+
+	// The empty nodes waiting for a gem held above them, since the last drop.
+	TBitArray<> _heldNodes;
+
 #pragma endregion
 
 #pragma region Public functions
@@ -93,6 +112,10 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Lane|Life Time")
 	void CLearLane();
 
+	//Keep the existing nodes, delete or create only the difference with the new length, and place them all again.
+	void ResizeLane(int laneLength, int lane_index, EGridGemNodePopMethod innerGemPopMethod = popAtPosition,
+	                bool popMethodForAll = false);
+
 	//Get the Lane recycler position
 	UFUNCTION(BlueprintCallable, Category="Puzzle Lane|Query")
 	FVector GetLaneRecyclerLocation() { return GetComponentLocation() + GetComponentTransform().TransformVector(_directionToRecycler); }
@@ -111,6 +134,38 @@ public:
 	//Add radial force to nodes in range. maxIntensity is the force strength at the center.
 	void AddRadialForce(FVector center, float radius, float maxIntensity);
 
+	//Let the grid update the lane and it's nodes instead of their own tick. ticks stay on for Blueprint tick events.
+	void SetTickedByGrid(bool tickedByGrid);
+
+	//Let the lane plan it's refills instead of letting it's nodes poll for a gem.
+	void SetUsesRefillPlanner(bool usesRefillPlanner);
+
+	//Does the lane plan it's refills?
+	FORCEINLINE bool UsesRefillPlanner() const { return _usesRefillPlanner; }
+
+	//Request a refill plan, after a node of the lane got empty. lanes ticked by the grid are queued on it.
+	void MarkRefillPending();
+
+	//Is a refill plan requested?
+	FORCEINLINE bool IsRefillPending() const { return _isRefillPending; }
+
+	//Drop every movable gem to it's final node and fill the empty nodes from the grid, in one pass. the lane stays
+	//pending if the grid could not give enough gems. returns true if the lane is full.
+	bool PlanRefill(float deltaTime);
+
+	//Drop every movable gem to it's final node. empty nodes under a gem that can't fall wait for it, until their grid
+	//direct request delay is over. returns the number of empty nodes left to spawn gems in.
+	int DropGems(float deltaTime);
+
+	//Attach spawned gems to the empty nodes that don't wait for a gem, from the bottom. returns the number of gems used.
+	int FillVacancies(TArrayView<APuzzleGem* const> gems);
+
+	//Get the number of nodes without gem.
+	int GetVacancyCount() const;
+
+	//Do empty nodes wait for a gem held above them?
+	FORCEINLINE bool HasHeldNodes() const { return _heldNodes.Contains(true); }
+
 #pragma endregion
 
 
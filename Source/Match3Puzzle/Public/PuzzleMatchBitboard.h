@@ -0,0 +1,71 @@
+// Copyright © 2023 by Tyni Boat. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+
+// Bitboard of the gem types in a grid. Holds one bit mask per gem type for every lane and every row, so aligned
+// matches are found with shift and AND operations instead of comparing gems cell by cell.
+struct MATCH3PUZZLE_API FPuzzleMatchBitboard
+{
+public:
+	//The maximum number of cells a lane or a row can have to fit in a bitboard line.
+	static constexpr int MaxLineLength = 64;
+
+	//The type slot of a gem that can match with any other type (gem without equatable).
+	static constexpr int WildcardType = -2;
+
+public:
+	//Reset the bitboard for a grid size, clearing every cell. returns false if the grid lines can't fit in a bitboard line.
+	bool Reset(int laneCount, int laneLength);
+
+	//Set the type slot of a cell. type slots are dense indexes starting at zero, or WildcardType.
+	void SetCell(int lane, int node, int typeSlot);
+
+	//Find the runs of at least minCount matching cells in a lane. runs are appended as (first node, last node), in node order.
+	void FindLaneRuns(int lane, int minCount, TArray<FIntPoint>& runs) const;
+
+	//Find the runs of at least minCount matching cells in a row. runs are appended as (first lane, last lane), in lane order.
+	void FindRowRuns(int node, int minCount, TArray<FIntPoint>& runs) const;
+
+	//Get the number of lanes of the bitboard.
+	FORCEINLINE int GetLaneCount() const { return _laneCount; }
+
+	//Get the number of nodes per lane of the bitboard.
+	FORCEINLINE int GetLaneLength() const { return _laneLength; }
+
+	//Get the number of gem type slots currently used in the bitboard.
+	FORCEINLINE int GetTypeCount() const { return _typeCount; }
+
+private:
+	//Find the runs of a line in a set of type masks laid out as [type * lineCount + line].
+	void FindLineRuns(const TArray<uint64>& typeMasks, const TArray<uint64>& wildcardMasks, int line, int lineCount,
+	                  int minCount, TArray<FIntPoint>& runs) const;
+
+	//Append the runs chained by a link mask (bit n links the cell n to the cell n + 1) as (first cell, last cell), keeping
+	//the ones of at least minCount cells.
+	static void AppendRunsFromLinks(uint64 links, int minCount, TArray<FIntPoint>& runs);
+
+private:
+	//The number of lanes.
+	int _laneCount = 0;
+
+	//The number of nodes per lane.
+	int _laneLength = 0;
+
+	//The number of type slots in use.
+	int _typeCount = 0;
+
+	//Masks of the lanes, laid out as [type * lane count + lane]. bit n is the node n.
+	TArray<uint64> _laneMasks;
+
+	//Masks of the rows, laid out as [type * lane length + node]. bit n is the lane n.
+	TArray<uint64> _rowMasks;
+
+	//Wildcard cell masks of the lanes. bit n is the node n.
+	TArray<uint64> _wildcardLaneMasks;
+
+	//Wildcard cell masks of the rows. bit n is the lane n.
+	TArray<uint64> _wildcardRowMasks;
+};
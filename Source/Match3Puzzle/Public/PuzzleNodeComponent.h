@@ -13,6 +13,46 @@
 #include "PuzzleNodeComponent.generated.h"
 
 
+class UPuzzleNodeComponent;
+
+//The movement of a node's gem over a frame. packed by the node, evaluated on any thread and applied by the node.
+struct FNodeGemMotion
+{
+	//The node moving it's gem. null if there is nothing to apply.
+	UPuzzleNodeComponent* Node = nullptr;
+
+	//Is the gem falling toward the node? other gems only get their idle and landing checks.
+	bool IsFalling = false;
+
+	//Is the gem moved by an external push force?
+	bool IsPushed = false;
+
+	//The easing function of the movement.
+	TEnumAsByte<EMoveEasingType> EasingType;
+
+	//The location the movement started from.
+	FVector StartLocation = FVector::ZeroVector;
+
+	//The location the movement ends at.
+	FVector TargetLocation = FVector::ZeroVector;
+
+	//The movement completion amount after this frame.
+	float MovementAmount = 0;
+
+	//The easing value of the last frame.
+	float LastEasingValue = 0;
+
+	//Result: the easing value of this frame.
+	float EasingValue = 0;
+
+	//Result: the gem location for this frame.
+	FVector Location = FVector::ZeroVector;
+
+	//Result: did the gem reach the landing point on this frame?
+	bool HasLanded = false;
+};
+
+
 //Puzzle Node, representing the place where the Gem must be located at. Cannot operate outside of a Puzzle Lane.
 UCLASS(ClassGroup = (Match3Puzzle), BlueprintType, Blueprintable
 	, hidecategories = (Object, LOD, Lighting, TextureStreaming, Velocity, PlanarMovement, MovementComponent, Tags,
@@ -30,6 +70,10 @@ public:
 	UPROPERTY(BlueprintReadOnly, VisibleAnywhere, Category = "Puzzle Node|Node Params")
 	FVector2D GridIndex = FVector2D(-1, -1);
 
+	//The node's grid position as integer cell coordinates.
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere, Category = "Puzzle Node|Node Params")
+	FIntPoint GridCell = FIntPoint(-1, -1);
+
 	//Forces gem to be retrieve only from the grid.
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Puzzle Node|Node Params")
 	bool IsGemFromGridOnly = false;
@@ -70,6 +114,22 @@ public:
 	//The landing force.
 	UPROPERTY()
 	FVector _landingForce;
+
+	//The gem spawn location, cached for the pop method it was computed with.
+	UPROPERTY()
+	FVector _gemSpawnLocation;
+
+	//The pop method the gem spawn location was computed with.
+	UPROPERTY()
+	TEnumAsByte<EGridGemNodePopMethod> _spawnLocationMethod;
+
+	//Does the pop method give a spawn location? false when gems keep their own location.
+	UPROPERTY()
+	bool _hasSpawnLocation;
+
+	//Did the grid move since the gem spawn location was computed?
+	UPROPERTY()
+	bool _isSpawnLocationStale = true;
 	
 #pragma endregion
 
@@ -81,6 +141,9 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Node|Life Time")
 	void InitializeNode(UPuzzleLaneComponent* owner_lane, FVector2D node_index);
 
+	//Initialize the node in it's lane at an integer cell (c++)
+	void InitializeNode(UPuzzleLaneComponent* owner_lane, FIntPoint node_cell);
+
 	//Clear the node and reinitialize values
 	UFUNCTION(BlueprintCallable, Category="Puzzle Node|Life Time")
 	void CLearNode();
@@ -93,6 +156,19 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Node|Movement")
 	void MoveGemToNode(float delta);
 
+	//Pack the current gem movement for this frame. returns false if there is nothing to evaluate. (game thread)
+	bool BeginGemMotion(float delta, FNodeGemMotion& motion);
+
+	//Evaluate the easing and location of a packed gem movement. touches no object, safe on any thread.
+	static void EvaluateGemMotion(FNodeGemMotion& motion);
+
+	//Apply an evaluated gem movement, then handle the gem idle state and landing. batched motions place the gem without
+	//sweep nor overlap update. (game thread)
+	void EndGemMotion(float delta, const FNodeGemMotion& motion, bool isBatched = false);
+
+	//Place the current gem without sweep nor overlap update, teleporting it's physics. (game thread)
+	void CommitGemLocation(const FVector& location);
+
 #pragma endregion
 
 #pragma region Public functions
@@ -110,6 +186,9 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Node|Query")
 	void RequestGemFromLane(float deltaTime);
 
+	//Wait for a gem held by the node above. returns true when the delay to request a gem directly from grid is over. (c++)
+	bool UpdateGridDirectRequest(float deltaTime);
+
 	//Get the right easing function end it's result to ease a gem movement
 	static float MoveByEasing(TEnumAsByte<EMoveEasingType> type, float inputValue);
 
@@ -122,10 +201,47 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Puzzle Node|Query")
 	FVector2D GetNodeIndexInDirection(FVector direction);
 
+	//Get get node cell in a global direction. if direction is invalid, returns node self cell. (c++)
+	FIntPoint GetNodeCellInDirection(FVector direction);
+
 	//Get custom gem spawn location relative to the node
 	UFUNCTION(BlueprintCallable, Category="Puzzle Node|Query")
 	FVector GetCustomGemSpawnLocation(FVector baseLocation);
 
+	//Compute the gem spawn location of the current pop method.
+	void RefreshGemSpawnLocation();
+
+	//Recompute the gem spawn location on next use. called when the grid moves.
+	FORCEINLINE void MarkSpawnLocationStale() { _isSpawnLocationStale = true; }
+
+	//Notify the grid that the node's cell changed, so it gets rescanned for matches.
+	void MarkCellDirty();
+
+	//Request a gem and move the current one. delta is already scaled by the grid time scale.
+	void UpdateNode(float delta);
+
+	//Let the grid update the node instead of it's own tick. the tick stays on for Blueprint tick events.
+	void SetTickedByGrid(bool tickedByGrid);
+
+	//Wake the node so it gets updated again. Use it when moving a gem outside of the node functions.
+	UFUNCTION(BlueprintCallable, Category="Puzzle Node|Life Time")
+	void WakeNode();
+
+	//Stop updating the node until it's woken.
+	void SleepNode();
+
+	//Can the node sleep? true when it holds a settled gem with no movement nor landing pending.
+	bool CanNodeSleep() const;
+
+	//Is the node updated?
+	FORCEINLINE bool IsNodeAwake() const { return _isNodeAwake; }
+
+	//Get the gem currently attached to the node
+	FORCEINLINE APuzzleGem* GetCurrentGem() const { return _currentGem; }
+
+	//Enable the node tick if the node ticks itself and is awake, or has a Blueprint tick.
+	void RefreshNodeTick();
+
 
 #pragma endregion
 
@@ -148,6 +264,14 @@ protected:
 	UPROPERTY()
 	FVector _externalPushForce;
 
+	// Is the node updated by the grid instead of it's own tick?
+	UPROPERTY()
+	bool _isTickedByGrid = false;
+
+	// Is the node updated? asleep nodes hold a settled gem and cost nothing until woken.
+	UPROPERTY()
+	bool _isNodeAwake = true;
+
 #pragma endregion
 
 
@@ -8,6 +8,8 @@
 #include "PuzzleStructs.generated.h"
 
 
+class UPuzzleNodeComponent;
+
 #pragma region Structures
 
 //The structure used to swap gems.
@@ -37,6 +39,18 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Match3Puzzle")
 	USplineComponent* CustomPath;
 
+	//Was the swap rejected before it began? rejected swaps only play a reject animation, gems stay on their nodes.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Match3Puzzle")
+	bool isRejected;
+
+	//The node holding the first gem. set by the grid when the swap is admitted.
+	UPROPERTY()
+	UPuzzleNodeComponent* NodeA;
+
+	//The node holding the second gem. set by the grid when the swap is admitted.
+	UPROPERTY()
+	UPuzzleNodeComponent* NodeB;
+
 public:
 	FGemSwapHandler()
 	{
@@ -44,6 +58,9 @@ public:
 		GemB = nullptr;
 		swapCompletion = 0;
 		isUserMadeSwap = false;
+		isRejected = false;
+		NodeA = nullptr;
+		NodeB = nullptr;
 	}
 
 	FGemSwapHandler(APuzzleGem* A, APuzzleGem* B, bool userMade = false)
@@ -52,6 +69,9 @@ public:
 		GemB = B;
 		swapCompletion = 0;
 		isUserMadeSwap = userMade;
+		isRejected = false;
+		NodeA = nullptr;
+		NodeB = nullptr;
 	}
 
 
@@ -126,60 +146,72 @@ public:
 	{
 	}
 
-	FGridMatch(TArray<FVector2D> positions)
+	FGridMatch(TArrayView<const FIntPoint> positions)
 	{
-		MatchPositions.Empty();
-		if (positions.Num() > 0)
-		{
-			for (auto pos : positions)
-				MatchPositions.AddUnique(pos);
-		}
+		MatchPositions.Reserve(positions.Num());
+		for (const auto pos : positions)
+			MatchPositions.AddUnique(FVector2D(pos.X, pos.Y));
 	}
 
-	FGridMatch(TArray<FVector2D> positions, TArray<FVector2D> swappedGems)
+	FGridMatch(TArrayView<const FIntPoint> positions, TArrayView<const FIntPoint> swappedGems)
+		: FGridMatch(positions)
 	{
-		MatchPositions.Empty();
-		if (positions.Num() > 0)
-		{
-			for (auto pos : positions)
-				MatchPositions.AddUnique(pos);
-		}
+		MoveSwappedPositionToEnd<FVector2D>(MatchPositions, swappedGems);
+	}
 
-		if (MatchPositions.Num() > 0 && swappedGems.Num() > 0)
+	//Move the earliest swapped position of a match to it's end, in place. the other positions keep their order.
+	template <typename T>
+	static void MoveSwappedPositionToEnd(TArrayView<T> positions, TArrayView<const FIntPoint> swappedGems)
+	{
+		if (positions.Num() <= 0 || swappedGems.Num() <= 0)
+			return;
+		int lowestIndexInSwaps = TNumericLimits<int>().Max();
+		int swappedPosition = INDEX_NONE;
+		for (int i = 0; i < positions.Num(); i++)
 		{
-			int lowestIndexInSwaps = TNumericLimits<int>().Max();
-			for (int i = MatchPositions.Num() - 1; i >= 0; i--)
-			{
-				FVector2D matchPos = MatchPositions[i];
-				const int swapIndex = swappedGems.IndexOfByPredicate([matchPos](FVector2D swap)-> bool
-				{
-					return swap == matchPos;
-				});
-				if(!swappedGems.IsValidIndex(swapIndex))
-					continue;
-				if(swapIndex >= lowestIndexInSwaps)
-					continue;
-				lowestIndexInSwaps = swapIndex;
-				MatchPositions.Add(matchPos);
-				MatchPositions.RemoveAt(i);
-			}
+			const int swapIndex = swappedGems.IndexOfByKey(FIntPoint((int32)positions[i].X, (int32)positions[i].Y));
+			if (swapIndex == INDEX_NONE || swapIndex >= lowestIndexInSwaps)
+				continue;
+			lowestIndexInSwaps = swapIndex;
+			swappedPosition = i;
 		}
+		MovePositionToEnd(positions, swappedPosition);
+	}
+
+	//Move a position of a match to it's end, in place. the other positions keep their order.
+	template <typename T>
+	static void MovePositionToEnd(TArrayView<T> positions, int index)
+	{
+		if (!positions.IsValidIndex(index))
+			return;
+		const T moved = positions[index];
+		for (int i = index; i < positions.Num() - 1; i++)
+			positions[i] = positions[i + 1];
+		positions[positions.Num() - 1] = moved;
 	}
 
 	//Check intersection with another match and return intersection indexes; X=this index, Y=other index
-	FVector2D Intersect(FGridMatch other)
+	FIntPoint Intersect(const FGridMatch& other) const
 	{
 		if (MatchPositions.Num() <= 0 || other.MatchPositions.Num() <= 0)
-			return FVector2D(-1, -1);
+			return FIntPoint(-1, -1);
 		for (int i = 0; i < MatchPositions.Num(); i++)
 		{
 			for (int j = 0; j < other.MatchPositions.Num(); j++)
 			{
 				if (MatchPositions[i] == other.MatchPositions[j])
-					return FVector2D(i, j);
+					return FIntPoint(i, j);
 			}
 		}
-		return FVector2D(-1, -1);
+		return FIntPoint(-1, -1);
+	}
+
+	//Get the match positions as grid cells
+	void GetMatchCells(TArray<FIntPoint>& cells) const
+	{
+		cells.Reset(MatchPositions.Num());
+		for (const auto pos : MatchPositions)
+			cells.Add(FIntPoint((int32)pos.X, (int32)pos.Y));
 	}
 
 	//Clear the match
@@ -189,7 +221,7 @@ public:
 	}
 
 	//Check if match is empty
-	bool IsEmpty()
+	bool IsEmpty() const
 	{
 		return MatchPositions.IsEmpty();
 	}